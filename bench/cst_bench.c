@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ - CST self-benchmark (make bench)
+ -
+ - Runs the synthetic suite (cst_bench_suite.c) at each size given, and
+ - derives the harness' own costs from wall times:
+ -
+ - startup    A run where -filter matches nothing: registration, argument
+ -            parsing and exit, but no test
+ - per_test   Fork, run and reap of an empty test, past startup
+ - per_test_timeout   The same with -timeout, which polls the test
+ -
+ - Micro benchmarks run as tests, so memcheck is on, and once more with
+ - -nomem as a baseline. Everything is written as JSON to the output file.
+ */
+
+#define BENCH_REPEAT 3
+
+typedef struct bench_result {
+	char	name[64];
+	long	tests;
+	double	value;
+	char	unit[16];
+} bench_result;
+
+static bench_result	g_results[256];
+static size_t		g_count = 0;
+
+static void add_result(const char *name, long tests, double value, const char *unit)
+{
+	bench_result *result;
+
+	if (g_count == sizeof(g_results) / sizeof(g_results[0]))
+		return;
+	result = &g_results[g_count++];
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	snprintf(result->unit, sizeof(result->unit), "%s", unit);
+	result->tests = tests;
+	result->value = value;
+	printf("  %-32s", name);
+	if (tests > 0)
+		printf("%8ld tests  ", tests);
+	else
+		printf("%15s", "");
+	printf("%14.2f %s\n", value, unit);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Wall time of the suite, with its output in `out` (/dev/null if NULL) */
+static double run_suite(const char *suite, long tests, bool micro, const char *flag1, const char *flag2, int out)
+{
+	char	count[32];
+	double	start = now_ms();
+	pid_t	pid;
+	int		status;
+
+	snprintf(count, sizeof(count), "%ld", tests);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(2);
+	}
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		dup2(out != -1 ? out : null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		setenv("CST_BENCH_TESTS", count, 1);
+		if (micro)
+			setenv("CST_BENCH_MICRO", "1", 1);
+		execl(suite, suite, flag1, flag2, (char *) NULL);
+		_exit(127);
+	}
+	waitpid(pid, &status, 0);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "Could not run %s\n", suite);
+		exit(2);
+	}
+	return now_ms() - start;
+}
+
+/* Best of a few runs, the least disturbed by the rest of the machine */
+static double best_run(const char *suite, long tests, const char *flag1, const char *flag2)
+{
+	double best = 0;
+
+	for (int i = 0; i < BENCH_REPEAT; i++) {
+		double ms = run_suite(suite, tests, false, flag1, flag2, -1);
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+static void bench_size(const char *suite, long tests)
+{
+	double startup = best_run(suite, tests, "-filter=@none", NULL);
+	double run = best_run(suite, tests, NULL, NULL);
+	double polled = best_run(suite, tests, "-timeout=60000", NULL);
+
+	add_result("startup", tests, startup, "ms");
+	add_result("per_test", tests, (run - startup) * 1e3 / tests, "us");
+	add_result("per_test_timeout", tests, (polled - startup) * 1e3 / tests, "us");
+}
+
+/* Collects the "@bench <name> <value> <unit>" lines of the micro benchmarks */
+static void bench_micro(const char *suite, const char *flag, const char *suffix)
+{
+	char	path[] = "/tmp/cst-bench-XXXXXX";
+	char	line[256];
+	int		fd = mkstemp(path);
+	FILE	*out;
+
+	if (fd == -1 || (out = fdopen(fd, "r")) == NULL) {
+		perror("mkstemp");
+		exit(2);
+	}
+	unlink(path);
+	run_suite(suite, 0, true, "-filter=Micro", flag, fd);
+	rewind(out);
+	while (fgets(line, sizeof(line), out) != NULL) {
+		char name[64];
+		char full[96];
+		char unit[16];
+		double value;
+		if (sscanf(line, "@bench %63s %lf %15s", name, &value, unit) != 3)
+			continue;
+		snprintf(full, sizeof(full), "%s%s", name, suffix);
+		add_result(full, 0, value, unit);
+	}
+	fclose(out);
+}
+
+static bool write_results(const char *path)
+{
+	FILE *out = fopen(path, "w");
+
+	if (out == NULL)
+		return false;
+	fprintf(out, "{\n  \"results\": [\n");
+	for (size_t i = 0; i < g_count; i++) {
+		fprintf(out, "    { \"name\": \"%s\", ", g_results[i].name);
+		if (g_results[i].tests > 0)
+			fprintf(out, "\"tests\": %ld, ", g_results[i].tests);
+		fprintf(out, "\"value\": %.3f, \"unit\": \"%s\" }%s\n",
+			g_results[i].value, g_results[i].unit, i + 1 < g_count ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+	return fclose(out) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 4) {
+		fprintf(stderr, "Usage: %s <suite> <output.json> <tests>...\n", argv[0]);
+		return 1;
+	}
+	// Progress stays visible when piped
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	printf("⏱️  Benchmarking CST\n");
+	for (int i = 3; i < argc; i++) {
+		long tests = atol(argv[i]);
+		if (tests > 0)
+			bench_size(argv[1], tests);
+	}
+	bench_micro(argv[1], NULL, "");
+	bench_micro(argv[1], "-nomem", "_nomem");
+	if (!write_results(argv[2])) {
+		perror(argv[2]);
+		return 2;
+	}
+	printf("✅ Results written to %s\n", argv[2]);
+	return 0;
+}
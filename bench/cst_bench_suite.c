@@ -0,0 +1,89 @@
+#include "cst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ - Synthetic suite for cst_bench.c
+ -
+ - CST_BENCH_TESTS empty tests are registered at startup, as TEST would,
+ - so the driver can size the suite without generating sources. With
+ - CST_BENCH_MICRO set, the micro benchmarks below are registered too,
+ - and print their results as "@bench <name> <value> <unit>" lines.
+ */
+
+/* From cst_backtrace.c */
+bool	cst_bt_function(void *addr, char *buf, size_t size);
+
+#define BENCH_ALLOCS 200000
+#define BENCH_SYMBOLIZE 1000
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void empty_test(void)
+{
+}
+
+/* malloc and free pairs, with `live` other blocks tracked meanwhile */
+static void bench_allocs(size_t live)
+{
+	void	**blocks = malloc((live == 0 ? 1 : live) * sizeof(void *));
+	double	start;
+	double	elapsed;
+
+	ASSERT_NOT_NULL(blocks);
+	for (size_t i = 0; i < live; i++)
+		blocks[i] = malloc(32);
+	start = now_us();
+	for (size_t i = 0; i < BENCH_ALLOCS; i++)
+		free(malloc(32 + i % 64));
+	elapsed = now_us() - start;
+	for (size_t i = 0; i < live; i++)
+		free(blocks[i]);
+	free(blocks);
+	printf("@bench malloc_free_live_%zu %.0f ops/s\n", live, BENCH_ALLOCS / (elapsed / 1e6));
+}
+
+static void micro_allocs(void)
+{
+	bench_allocs(0);
+	bench_allocs(1000);
+	bench_allocs(100000);
+}
+
+static void micro_symbolize(void)
+{
+	void	*addrs[] = { (void *) empty_test, (void *) bench_allocs, (void *) micro_symbolize, (void *) printf };
+	char	name[256];
+	double	start = now_us();
+	double	cold;
+	size_t	count = sizeof(addrs) / sizeof(addrs[0]);
+
+	ASSERT_TRUE(cst_bt_function(addrs[0], name, sizeof(name)));
+	cold = now_us() - start;
+	start = now_us();
+	for (size_t i = 0; i < BENCH_SYMBOLIZE; i++)
+		cst_bt_function(addrs[i % count], name, sizeof(name));
+	printf("@bench symbolize_first %.1f us\n", cold);
+	printf("@bench symbolize %.2f us\n", (now_us() - start) / BENCH_SYMBOLIZE);
+}
+
+static void __attribute__((constructor)) register_suite(void)
+{
+	const char	*tests = getenv("CST_BENCH_TESTS");
+	long		count = tests != NULL ? atol(tests) : 0;
+
+	for (long i = 0; i < count; i++)
+		cst_register_test("Synthetic", "Empty test", -1, empty_test, __FILE__);
+	if (getenv("CST_BENCH_MICRO") == NULL)
+		return;
+	cst_register_test("Micro", "Allocations", -1, micro_allocs, __FILE__);
+	cst_register_test("Micro", "Symbolization", -1, micro_symbolize, __FILE__);
+}
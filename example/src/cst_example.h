@@ -2,6 +2,12 @@
 # define CST_EXAMPLE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* cst_header.c */
+
+int				cst_header_ratio(const uint8_t *data, size_t len);
 
 /* cst_isnum.c */
 
@@ -11,6 +17,9 @@ bool			cst_isnum(char ch);
 
 void			cst_force_leak(void);
 void			cst_force_double_free(void);
+void			cst_force_heap_overflow(void);
+void			cst_force_use_after_free(void);
+char			**cst_pair_dup(const char *a, const char *b);
 
 /* cst_sum.c */
 
@@ -0,0 +1,16 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "cst_example.h"
+
+/* "CST" magic, a version and a payload length per chunk, 0 if invalid */
+int	cst_header_ratio(const uint8_t *data, size_t len)
+{
+	if (len < 6)
+		return (0);
+	if (data[0] != 'C' || data[1] != 'S' || data[2] != 'T')
+		return (0);
+	if (data[3] != 1)
+		return (0);
+	// Divides by zero on purpose if the chunk length is 0
+	return (data[4] / data[5]);
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 void	cst_force_leak(void)
 {
@@ -12,3 +13,34 @@ void	cst_force_double_free(void)
 	free(ptr);
 	free(ptr);
 }
+
+// Only ever called with -memguard, which catches the write before it lands
+void	cst_force_heap_overflow(void)
+{
+	char *ptr = malloc(42);
+	ptr[42] = '!';
+	free(ptr);
+}
+
+void	cst_force_use_after_free(void)
+{
+	char *ptr = malloc(42);
+	free(ptr);
+	ptr[20] = '!';
+}
+
+char	**cst_pair_dup(const char *a, const char *b)
+{
+	char	**pair = malloc(2 * sizeof(char *));
+
+	if (pair == NULL)
+		return (NULL);
+	pair[0] = malloc(strlen(a) + 1);
+	pair[1] = malloc(strlen(b) + 1);
+	// Leaks on purpose if one of them failed
+	if (pair[0] == NULL || pair[1] == NULL)
+		return (NULL);
+	strcpy(pair[0], a);
+	strcpy(pair[1], b);
+	return (pair);
+}
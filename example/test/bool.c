@@ -22,3 +22,18 @@ TEST(category, "cst_isnum('1') == false") {
 TEST(category, "cst_isnum('a') == false") {
 	ASSERT_FALSE(cst_isnum('a'));
 }
+
+// Several checks per test
+
+TEST(category, "Assertions don't end passing tests") {
+	ASSERT_TRUE(cst_isnum('1'));
+	ASSERT_FALSE(cst_isnum('a'));
+	EXPECT_TRUE(cst_isnum('9'));
+	EXPECT_FALSE(cst_isnum('z'));
+}
+
+TEST(category, "Expectations run past failures (Shouldn't pass)") {
+	EXPECT_TRUE(cst_isnum('a'));
+	EXPECT_FALSE(cst_isnum('1'));
+	ASSERT_TRUE(cst_isnum('1'));
+}
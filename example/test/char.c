@@ -22,3 +22,40 @@ TEST(category, "cst_utoupper('a') == 'B'") {
 TEST(category, "cst_utoupper('a') == 'A'") {
 	ASSERT_UCHAR_EQUALS(cst_utoupper((unsigned char) 'a'), (unsigned char) 'A');
 }
+
+// Rows
+
+typedef struct upper_row {
+	char c;
+	char upper;
+} upper_row;
+
+static const upper_row upper_rows[] = {
+	{ 'a', 'A' }, { 'z', 'Z' }, { 'A', 'A' }, { '1', '1' }, { ' ', ' ' }
+};
+
+static const upper_row wrong_rows[] = {
+	{ 'a', 'A' }, { 'b', 'X' }, { 'c', 'C' }
+};
+
+TEST_P(category, "cst_toupper(row)", upper_rows, CST_ROWS(upper_rows)) {
+	ASSERT_CHAR_EQUALS(cst_toupper(row->c), row->upper);
+}
+
+TEST_P(category, "Rows after a failed row still run (Shouldn't pass)", wrong_rows, CST_ROWS(wrong_rows)) {
+	ASSERT_CHAR_EQUALS(cst_toupper(row->c), row->upper);
+}
+
+// Properties
+
+PROPERTY(category, "cst_toupper keeps non letters") {
+	char c = cst_gen_int(' ', '~');
+	if (c < 'a' || c > 'z')
+		ASSERT_CHAR_EQUALS(cst_toupper(c), c);
+}
+
+PROPERTY(category, "Strings are all digits (Shouldn't pass)") {
+	char *str = cst_gen_str(16, "0123456789abc");
+	for (size_t i = 0; str[i] != '\0'; i++)
+		ASSERT_TRUE(cst_isnum(str[i]));
+}
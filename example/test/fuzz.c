@@ -0,0 +1,15 @@
+#include "cst.h"
+#include "cst_example.h"
+
+static const char *category = "Fuzzing";
+
+FUZZ(category, "cst_utoupper") {
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = cst_utoupper(data[i]);
+		ASSERT_FALSE(c >= 'a' && c <= 'z');
+	}
+}
+
+FUZZ(category, "cst_header_ratio (Fails with -fuzz)") {
+	cst_header_ratio(data, len);
+}
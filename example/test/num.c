@@ -1,5 +1,6 @@
 #include "cst.h"
 #include "cst_example.h"
+#include <string.h>
 
 static const char *category = "Numeric assertions";
 
@@ -22,3 +23,63 @@ TEST(category, "cst_uintsum(40, 2) == 24") {
 TEST(category, "cst_uintsum(40, 2) == 42") {
 	ASSERT_UINT_EQUALS(cst_uintsum(40, 2), 42);
 }
+
+// Arrays
+
+TEST(category, "Int arrays equal") {
+	int expected[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	int sums[10];
+
+	for (int i = 0; i < 10; i++)
+		sums[i] = cst_intsum(i, 1);
+	ASSERT_INT_ARRAY_EQUALS(sums, expected, 10);
+}
+
+TEST(category, "Int arrays differ at [7] (Shouldn't pass)") {
+	int expected[] = { 1, 2, 3, 4, 5, 6, 7, 9, 9, 10 };
+	int sums[10];
+
+	for (int i = 0; i < 10; i++)
+		sums[i] = cst_intsum(i, 1);
+	ASSERT_INT_ARRAY_EQUALS(sums, expected, 10);
+}
+
+TEST(category, "Float arrays within 4 ULP") {
+	float expected[] = { 0.3f, 1.0f, 1e-30f };
+	float got[] = { 0.1f + 0.2f, 0.1f * 10, 1e-30f };
+
+	ASSERT_FLOAT_ARRAY_EQUALS(got, expected, 3);
+}
+
+TEST(category, "Double arrays within 1e-3 relative") {
+	double expected[] = { 1000.0, 2000.0 };
+	double got[] = { 1000.5, 2001.0 };
+
+	ASSERT_DOUBLE_ARRAY_EQUALS_REL(got, expected, 2, 1e-3);
+}
+
+TEST(category, "Double arrays within 1e-6 relative (Shouldn't pass)") {
+	double expected[] = { 1000.0, 2000.0 };
+	double got[] = { 1000.0, 2001.0 };
+
+	ASSERT_DOUBLE_ARRAY_EQUALS_REL(got, expected, 2, 1e-6);
+}
+
+// Memory
+
+TEST(category, "Buffers equal") {
+	char buffer[100];
+
+	memset(buffer, 'x', sizeof(buffer));
+	ASSERT_MEM_EQUALS(buffer, buffer, sizeof(buffer));
+}
+
+TEST(category, "Buffers differ at offset 37 (Shouldn't pass)") {
+	char got[100];
+	char expected[100];
+
+	memset(got, 'x', sizeof(got));
+	memset(expected, 'x', sizeof(expected));
+	got[37] = '\0';
+	ASSERT_MEM_EQUALS(got, expected, sizeof(got));
+}
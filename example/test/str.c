@@ -34,3 +34,45 @@ TEST(category, "\"Hi\" == \"Hi\" (Free)") {
 TEST(category, "\"Hi\" != \"Bye\" (Free)") {
 	ASSERT_STR_NOT_EQUALS_FREE(strdup("Hi"), "Bye");
 }
+
+// Large text
+
+TEST(category, "Text == Text") {
+	ASSERT_TEXT_EQUALS("first line\nsecond line\n", "first line\nsecond line\n");
+}
+
+TEST(category, "Text == Text with a typo (Shouldn't pass)") {
+	ASSERT_TEXT_EQUALS("first line\nsecond line\nthird line, a bit longer than the others\n",
+		"first line\nsecond line\nthird line, a bit longer than the other\n");
+}
+
+TEST(category, "NULL text == NULL") {
+	ASSERT_TEXT_EQUALS(NULL, NULL);
+}
+
+// Snapshots, see cst-snapshots/
+
+static size_t upper_report(char *buf, size_t size)
+{
+	const char *words[] = { "alpha", "beta", "gamma", "delta" };
+	size_t len = 0;
+
+	for (size_t i = 0; i < 4 && len < size; i++) {
+		for (const char *c = words[i]; *c != '\0' && len + 2 < size; c++)
+			buf[len++] = cst_toupper(*c);
+		buf[len++] = '\n';
+	}
+	return len;
+}
+
+TEST(category, "Report matches its snapshot") {
+	char report[64];
+
+	ASSERT_MATCHES_SNAPSHOT(report, upper_report(report, sizeof(report)), "report");
+}
+
+TEST(category, "Report matches a stale snapshot (Shouldn't pass)") {
+	char report[64];
+
+	ASSERT_MATCHES_SNAPSHOT(report, upper_report(report, sizeof(report)), "report");
+}
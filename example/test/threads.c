@@ -0,0 +1,71 @@
+#include "cst.h"
+#include <pthread.h>
+
+static const char *category = "Multithreading";
+
+static void *allocate_and_free(void *arg)
+{
+	(void) arg;
+	for (int i = 0; i < 10000; i++)
+		free(malloc(32));
+	return (NULL);
+}
+
+static void *allocate_and_leak(void *arg)
+{
+	(void) arg;
+	return (malloc(24));
+}
+
+TEST(category, "Allocations from 8 threads") {
+	pthread_t	threads[8];
+
+	for (int i = 0; i < 8; i++)
+		pthread_create(&threads[i], NULL, allocate_and_free, NULL);
+	for (int i = 0; i < 8; i++)
+		pthread_join(threads[i], NULL);
+	ASSERT_FALSE(cst_has_leaks());
+}
+
+TEST(category, "Leak from a thread (Shouldn't pass)") {
+	pthread_t	thread;
+
+	pthread_create(&thread, NULL, allocate_and_leak, NULL);
+	pthread_join(thread, NULL);
+	ASSERT_NULL(NULL);
+}
+
+static void *spin_forever(void *arg)
+{
+	volatile bool *stop = arg;
+
+	while (!*stop)
+		;
+	return (NULL);
+}
+
+TEST(category, "Deadlocked threads (Shouldn't pass)", 200) {
+	volatile bool	stop = false;
+	pthread_t		thread;
+
+	pthread_create(&thread, NULL, spin_forever, (void *) &stop);
+	pthread_join(thread, NULL);
+}
+
+static size_t increments = 0;
+
+static void increment(size_t thread, size_t iteration)
+{
+	(void) thread;
+	(void) iteration;
+	__atomic_fetch_add(&increments, 1, __ATOMIC_RELAXED);
+}
+
+TEST(category, "Atomic increments from 4 threads") {
+	cst_concurrent_run(increment, 4, 100000);
+	ASSERT_ULONG_EQUALS(increments, 4 * 100000);
+}
+
+TEST_CONCURRENT(category, "Failure on one worker (Shouldn't pass)", 4, 1000) {
+	ASSERT_TRUE(thread != 2 || iteration < 500);
+}
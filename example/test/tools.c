@@ -1,8 +1,12 @@
 #include "cst.h"
 #include "cst_example.h"
+#include <time.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 static const char *category = "Tests for built-in tools";
+static char *fixture = NULL;
 
 CST_BEFORE_ALL(NULL) {
 	printf(CST_BLUE"BEFORE ALL: NULL category"CST_RES"\n");
@@ -14,6 +18,8 @@ CST_AFTER_ALL(NULL) {
 
 CST_BEFORE_ALL(category) {
 	printf(CST_BLUE"BEFORE ALL: \"%s\" category"CST_RES"\n", category);
+	// Not a leak of every test in the category, as it was allocated before them
+	fixture = malloc(64);
 }
 
 CST_BEFORE_EACH(category) {
@@ -22,6 +28,7 @@ CST_BEFORE_EACH(category) {
 
 CST_AFTER_ALL(category) {
 	printf(CST_BLUE"AFTER ALL: \"%s\" category"CST_RES"\n", category);
+	free(fixture);
 }
 
 CST_AFTER_EACH(category) {
@@ -33,6 +40,17 @@ TEST(category, "Force SIGSEGV") {
 	ASSERT_TRUE(null_str[0]);
 }
 
+static int overflow_stack(volatile int depth) {
+	volatile char frame[256];
+
+	frame[0] = (char) depth;
+	return overflow_stack(depth + 1) + frame[0];
+}
+
+TEST(category, "Force stack overflow") {
+	ASSERT_TRUE(overflow_stack(0));
+}
+
 TEST(category, "Force double free") {
 	char	*ptr = malloc(sizeof(char *));
 
@@ -45,12 +63,131 @@ TEST(category, "Force double free (src)") {
 	ASSERT_NULL(NULL);
 }
 
+// Without redzones, these would only corrupt the heap and pass
+TEST(category, "Force heap overflow (Shouldn't pass with -memguard)") {
+	if (!cst_memguard_enabled())
+		return ;
+	cst_force_heap_overflow();
+	ASSERT_NULL(NULL);
+}
+
+TEST(category, "Force use after free (Shouldn't pass with -memguard)") {
+	if (!cst_memguard_enabled())
+		return ;
+	cst_force_use_after_free();
+	ASSERT_NULL(NULL);
+}
+
+TEST(category, "Unhandled allocation failure (Shouldn't pass with -allocfail)") {
+	char	**pair = cst_pair_dup("Hi", "Bye");
+
+	if (pair == NULL)
+		return ;
+	free(pair[0]);
+	free(pair[1]);
+	free(pair);
+}
+
 TEST(category, "Force memory leak (Shouldn't pass)") {
 	char *ptr = malloc(42);
 	ASSERT_NULL(NULL);
 }
 
+TEST(category, "Force repeated memory leak (Shouldn't pass)") {
+	for (int i = 0; i < 3; i++)
+		cst_pair_dup("Hi", "Bye");
+	ASSERT_NULL(NULL);
+}
+
+TEST(category, "No allocations") {
+	char	upper = 0;
+
+	// Asserting after the scope, so it always ends and checks its allocations
+	ASSERT_NO_ALLOCS {
+		upper = cst_toupper('a');
+	}
+	ASSERT_CHAR_EQUALS(upper, 'A');
+}
+
+TEST(category, "Max allocations (Shouldn't pass)") {
+	ASSERT_MAX_ALLOCS(1) {
+		for (int i = 0; i < 3; i++)
+			free(malloc(16));
+	}
+	ASSERT_NULL(NULL);
+}
+
+TEST(category, "Busy loop (-profile)") {
+	volatile long	total = 0;
+
+	for (long i = 0; i < 20000000; i++)
+		total += cst_toupper('a' + i % 26);
+	ASSERT_TRUE(total > 0);
+}
+
 TEST(category, "Force timeout", 1) {
 	while (true)
 		sleep(1);
 }
+
+/* Sleeps 1s, 2s, 4s... between attempts, gives up after `attempts` */
+static bool retry_with_backoff(bool (*attempt)(void), int attempts)
+{
+	for (int i = 0; i < attempts; i++) {
+		if (attempt())
+			return true;
+		if (i + 1 < attempts)
+			sleep(1u << i);
+	}
+	return false;
+}
+
+static bool always_fails(void)
+{
+	return false;
+}
+
+TEST(category, "Backoff sleeps in virtual time", 100) {
+	struct timespec	start;
+	struct timespec	end;
+	time_t			before;
+
+	cst_virtual_time();
+	before = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ASSERT_FALSE(retry_with_backoff(always_fails, 6));
+	ASSERT_LONG_EQUALS(time(NULL) - before, 31);
+	usleep(250000);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ASSERT_LONG_EQUALS((end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec), 31250000000L);
+}
+
+/* Fails if the file is already there, so each test must start with an empty directory */
+static void create_scratch_file(void)
+{
+	char	path[512];
+	int		fd;
+
+	ASSERT_NOT_NULL(CST_TMPDIR);
+	ASSERT_STR_EQUALS(getenv("CST_TMPDIR"), CST_TMPDIR);
+	snprintf(path, sizeof(path), "%s/data.txt", CST_TMPDIR);
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	ASSERT_INT_NOT_EQUALS(fd, -1);
+	ASSERT_INT_EQUALS(write(fd, "data", 4), 4);
+	close(fd);
+}
+
+TEST(category, "Scratch directories are per test") {
+	create_scratch_file();
+}
+
+TEST(category, "Scratch directories start empty") {
+	create_scratch_file();
+}
+
+TEST(category, "Scratch directories are exported from the start") {
+	char	*tmpdir = getenv("TMPDIR");
+
+	ASSERT_NOT_NULL(tmpdir);
+	ASSERT_STR_EQUALS(tmpdir, CST_TMPDIR);
+}
@@ -6,29 +6,154 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stdarg.h>
 
 /*
  - cst_sighandler.c
  */
 
 void	cst_init_sighandler(void);
+void	cst_crash_defer_to(int fd);
+int		cst_crash_report(int fd, const char *test_name);
+bool	cst_request_dump(pid_t pid);
+
+/*
+ - cst_memcheck.c
+ */
+
+void	cst_memcheck_init(bool enabled, bool interpose, bool stats, bool guard, bool stacks);
+void	cst_memcheck_test_start(void);
+void	cst_forget_epoch(void);
+
+/*
+ - cst_allocfail.c
+ */
+
+void	cst_allocfail_init(bool enabled);
+void	cst_allocfail_test_next(void);
+void	cst_allocfail_test_start(long timeout_ms);
+size_t	cst_allocfail_waited_ms(void);
+
+/*
+ - cst_property.c
+ */
+
+void	cst_property_init(uint64_t seed, long runs);
+void	cst_property_failed(bool fatal);
+
+/*
+ - cst_fuzz.c
+ */
+
+void	cst_fuzz_init(long seconds, const char *dir);
+void	cst_fuzz_run(void (*body)(const uint8_t *, size_t));
+void	cst_fuzz_report(const char *name, void (*body)(const uint8_t *, size_t), int status);
+
+/*
+ - cst_memutil.c
+ */
+
+void	cst_print_diff(void);
+
+/*
+ - cst_snapshot.c
+ */
+
+void	cst_snapshot_init(bool update);
+
+/*
+ - cst_concurrent.c
+ */
+
+void	cst_concurrent_init(bool pin, bool perturb, uint64_t seed);
+int		cst_worker_index(void);
+
+/*
+ - cst_profile.c
+ */
+
+void	cst_profile_init(const char *path);
+void	cst_profile_test_start(void);
+void	cst_profile_test_end(void);
+void	cst_profile_test_done(const char *category, const char *name, void (*func)(void));
+void	cst_profile_finish(void);
+
+/*
+ - cst_impact.c
+ */
+
+void	cst_impact_init(const char *path, bool record, const char *changed, size_t tests);
+bool	cst_impact_selected(const char *category, const char *name, const char *file);
+void	cst_impact_test_begin(void);
+void	cst_impact_test_start(void);
+void	cst_impact_test_done(const char *category, const char *name, const char *file);
+void	cst_impact_finish(void);
+
+/*
+ - cst_time.c
+ */
+
+void	cst_time_init(bool all);
+void	cst_time_test_start(void);
+
+/*
+ - cst_tmpdir.c
+ */
+
+void	cst_tmpdir_init(void);
+void	cst_tmpdir_next(void);
+void	cst_tmpdir_test_start(void);
+void	cst_tmpdir_done(void);
 
 /*
  - Internal data
  */
 
+/* Time given to a hung test to dump its stacks before being killed */
+#define CST_DUMP_GRACE_MS 100
+
+/* Runs of a test repeated with -repeat or -until-fail */
+typedef struct cst_run_stats
+{
+	size_t			runs;
+	size_t			failures;
+	double			mean_ms;
+	double			m2;  // Sum of squared deviations from the mean, for the variance
+	double			min_ms;
+	double			max_ms;
+}	cst_run_stats;
+
 typedef struct cst_test
 {
 	const char		*category;
 	const char		*name;
+	const char		*file;  // Defining the test, __FILE__ at registration
 	void			(*func)(void);
+	void			(*row_func)(const void *rows, size_t index);
+	void			(*fuzz_func)(const uint8_t *data, size_t len);
+	const void		*rows;
+	size_t			count;  // Rows of a TEST_P, 1 otherwise
 	long			timeout;
+	bool			property;
 	bool			executed;
+	cst_run_stats	stats;
 	struct cst_test	*next;
 }	cst_test;
 
+/* Progress of the child running the rows of a TEST_P, shared with the runner */
+typedef struct cst_rows_state
+{
+	pid_t			pid;
+	size_t			next;
+	size_t			failed;
+}	cst_rows_state;
+
 typedef struct cst_hook
 {
 	const char		*category;
@@ -43,24 +168,113 @@ static cst_hook	*CST_AFTER_EACH = NULL;
 static cst_hook	*CST_BEFORE_ALL = NULL;
 static cst_hook	*CST_BEFORE_EACH = NULL;
 static bool		CST_MEMCHECK = true;
+static bool		CST_MEMCHECK_ALL = false;
+static bool		CST_MEMSTATS = false;
+static bool		CST_MEMGUARD = false;
+static bool		CST_MEMSTACKS = false;
+static bool		CST_ALLOCFAIL = false;
 static bool		CST_SIGHANDLER = true;
 static bool		CST_ON_TEST = false;
 static long		CST_TIMEOUT_MS = 0;
+static int		CST_CRASH_PIPE[2] = { -1, -1 };
+static int		CST_LAST_STATUS = 0;
+static char		*CST_PROFILE = NULL;
+static size_t	CST_FAILED_CHECKS = 0;
+static cst_rows_state	*CST_ROWS_STATE = NULL;
+static uint64_t	CST_SEED = 0;
+static long		CST_PROP_RUNS = 0;
+static bool		CST_PROPERTIES_RAN = false;
+static long		CST_FUZZ_SECONDS = 0;
+static char		*CST_CORPUS = NULL;
+static bool		CST_UPDATE_SNAPSHOTS = false;
+static char		*CST_FILTER = NULL;
+static bool		CST_IMPACT = false;
+static char		*CST_IMPACT_PATH = NULL;
+static char		*CST_CHANGED = NULL;
+static bool		CST_VIRTUAL_TIME = false;
+static size_t	CST_REPEAT = 0;
+static bool		CST_UNTIL_FAIL = false;
+static bool		CST_SHUFFLE = false;
+static bool		CST_PIN = false;
+static bool		CST_PERTURB = false;
 
 /*
  - Exposed variables
  */
 
-char	*CST_TEST_NAME			= "";
-char	*CST_FAIL_TIP			= NULL;
+char	*CST_TEST_CATEGORY		= "";
+__thread char	*CST_FAIL_TIP	= NULL;
 bool	CST_SHOW_FAIL_DETAILS	= true;
 bool	CST_DO_BACKTRACE		= true;
 
+static char				*CST_CURRENT_NAME = "";
+static __thread char	*CST_THREAD_NAME = NULL;
+
+char	**cst_test_name_slot(void)
+{
+	return (CST_THREAD_NAME != NULL ? &CST_THREAD_NAME : &CST_CURRENT_NAME);
+}
+
+/* Names the calling thread's failures, see cst_concurrent.c */
+void	cst_set_thread_name(char *name)
+{
+	CST_THREAD_NAME = name;
+}
+
 bool	cst_is_on_test(void)
 {
 	return CST_ON_TEST;
 }
 
+void	cst_assert_failed(bool fatal)
+{
+	CST_FAIL_TIP = NULL;
+	cst_print_diff();
+	__atomic_add_fetch(&CST_FAILED_CHECKS, 1, __ATOMIC_RELAXED);
+	// Runs of a property end here when they fail, see cst_property.c
+	cst_property_failed(fatal);
+	if (!fatal)
+		return;
+	// Other workers still hold their memory
+	if (cst_worker_index() == -1)
+		cst_check_leaks_before_exit();
+	exit(EXIT_FAILURE);
+}
+
+bool	cst_check_details(void)
+{
+	fprintf(stderr, CST_BRED"❌ %s"CST_RED, CST_TEST_NAME);
+	if (!CST_SHOW_FAIL_DETAILS)
+		return false;
+	fprintf(stderr, CST_GRAY": "CST_RED);
+	return true;
+}
+
+void	cst_check_failed(const cst_check_site *site, ...)
+{
+	va_list	args;
+	// Without a format, the assertion printed the start already
+	bool	details = site->format == NULL ? CST_SHOW_FAIL_DETAILS : cst_check_details();
+
+	if (details) {
+		if (site->format != NULL) {
+			va_start(args, site);
+			vfprintf(stderr, site->format, args);
+			va_end(args);
+		}
+		fprintf(stderr, " from %s "CST_GRAY"(%s:%d)"CST_RED, site->func, site->file, site->line);
+	}
+	if (CST_FAIL_TIP != NULL)
+		fprintf(stderr, CST_GRAY" - "CST_RED"%s", CST_FAIL_TIP);
+	fprintf(stderr, "\n"CST_RES);
+	cst_assert_failed(site->fatal);
+}
+
+size_t	cst_failed_checks(void)
+{
+	return __atomic_load_n(&CST_FAILED_CHECKS, __ATOMIC_RELAXED);
+}
+
 /*
  - Program exit util
  */
@@ -96,6 +310,7 @@ static void	cst_exit(char *errmsg, int ec)
 	cst_free();
 	if (errmsg != NULL)
 		printf(CST_RED"CST Error"CST_GRAY": "CST_BRED"%s"CST_RES"\n", errmsg);
+	fflush(stdout);
 	_exit(ec);
 }
 
@@ -143,60 +358,245 @@ static void cst_run_hook(cst_hook *lst, const char *category)
 	}
 }
 
-static bool cst_run_test(cst_test *test)
+/* Let a hung test dump where its threads are before killing it */
+static void cst_kill_hung_test(pid_t pid)
 {
+	int		ec;
+	size_t	start = cst_now_ms();
+
+	if (CST_DO_BACKTRACE && cst_request_dump(pid)) {
+		while (cst_now_ms() - start < CST_DUMP_GRACE_MS) {
+			if (waitpid(pid, &ec, WNOHANG) != 0)
+				return;
+			usleep(1000);
+		}
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, &ec, 0);
+}
+
+/* The name to report, which is the current row's for a TEST_P */
+static const char *cst_report_name(cst_test *test, char *buf, size_t size)
+{
+	if (test->row_func == NULL)
+		return (test->name);
+	snprintf(buf, size, "%s [%zu]", test->name, CST_ROWS_STATE->next);
+	return (buf);
+}
+
+/* A crash is kept as its signal alone, whether the handler reported it or it killed the child */
+static bool cst_reap_test(cst_test *test, char *name, size_t size)
+{
+	int	signum = cst_crash_report(CST_CRASH_PIPE[0], cst_report_name(test, name, size));
+
+	if (signum != 0)
+		CST_LAST_STATUS = signum;
+	else if (WIFSIGNALED(CST_LAST_STATUS))
+		CST_LAST_STATUS = WTERMSIG(CST_LAST_STATUS);
+	return (CST_LAST_STATUS == 0);
+}
+
+/* Also keeps the child's wait status in CST_LAST_STATUS */
+static bool cst_wait_test(cst_test *test, pid_t pid)
+{
+	char	name[CST_PATH_MAX];
+
+	CST_LAST_STATUS = 0;
+	if (test->timeout <= 0) {
+		waitpid(pid, &CST_LAST_STATUS, 0);
+		return (cst_reap_test(test, name, sizeof(name)));
+	}
+	size_t start = cst_now_ms();
+	// The fuzzing budget comes on top of the test's timeout
+	size_t timeout = (size_t) test->timeout + (test->fuzz_func != NULL ? (size_t) CST_FUZZ_SECONDS * 1000 : 0);
+	while (true) {
+		pid_t res = waitpid(pid, &CST_LAST_STATUS, WNOHANG);
+		if (res == -1)
+			cst_exit("waitpid failed", 3);
+		else if (res > 0)
+			return (cst_reap_test(test, name, sizeof(name)));
+		// Injected forks have timeouts of their own
+		size_t waited = cst_allocfail_waited_ms();
+		if ((cst_now_ms() - start) >= timeout + waited) {
+			cst_kill_hung_test(pid);
+			if (waited > 0)
+				printf(CST_BRED"❌ %s "CST_GRAY"-"CST_RED" Timed out (%zu ms, plus %zu ms waiting for -allocfail forks)\n"CST_RES,
+					cst_report_name(test, name, sizeof(name)), timeout, waited);
+			else
+				printf(CST_BRED"❌ %s "CST_GRAY"-"CST_RED" Timed out (%zu ms)\n"CST_RES,
+					cst_report_name(test, name, sizeof(name)), timeout);
+			fflush(stdout);
+			cst_crash_report(CST_CRASH_PIPE[0], name);
+			// As if the child was ended by an alarm, like inputs that hang when fuzzing
+			CST_LAST_STATUS = SIGALRM;
+			return false;
+		}
+		usleep(50);
+	}
+}
+
+/* Runs rows from the shared state's next one, each one is reported on its own */
+static void cst_run_rows(cst_test *test)
+{
+	char	name[CST_PATH_MAX];
+
+	for (size_t i = CST_ROWS_STATE->next; i < test->count; i++) {
+		size_t checks = __atomic_load_n(&CST_FAILED_CHECKS, __ATOMIC_RELAXED);
+		bool owner = getpid() == CST_ROWS_STATE->pid;
+		if (owner)
+			CST_ROWS_STATE->next = i;
+		snprintf(name, sizeof(name), "%s [%zu]", test->name, i);
+		CST_TEST_NAME = name;
+		test->row_func(test->rows, i);
+		bool leaked = cst_has_leaks();
+		if (leaked) {
+			cst_print_leaks();
+			cst_forget_epoch();
+		}
+		if (leaked || __atomic_load_n(&CST_FAILED_CHECKS, __ATOMIC_RELAXED) != checks)
+			CST_ROWS_STATE->failed += owner;
+		else
+			fprintf(stderr, CST_GREEN"✅ %s\n"CST_RES, CST_TEST_NAME);
+	}
+	if (getpid() == CST_ROWS_STATE->pid)
+		CST_ROWS_STATE->next = test->count;
+}
+
+/* Returns false if the test failed, rows that failed are added to `failed` */
+static bool cst_fork_test(cst_test *test, size_t *failed)
+{
+	// Anything still buffered would be printed again by the test
+	fflush(stdout);
+	fflush(stderr);
+	cst_tmpdir_next();
+	cst_allocfail_test_next();
+
 	pid_t	pid = fork();
 
 	if (pid == -1)
 		cst_exit("Failed to fork", 2);
 	if (pid == 0) {
-		void (*func)(void) = test->func;
+		cst_test copy = *test;
 		CST_ON_TEST = true;
-		CST_TEST_NAME = (char *) test->name;
-		cst_free();
-		func();
-		fprintf(stderr, CST_GREEN"✅ %s\n"CST_RES, CST_TEST_NAME);
+		CST_TEST_NAME = (char *) copy.name;
+		CST_TEST_CATEGORY = (char *) copy.category;
+		// Freeing the whole registry would make each child cost O(tests), it goes with the child
+		CST_TESTS = NULL;
+		CST_AFTER_ALL = CST_AFTER_EACH = CST_BEFORE_ALL = CST_BEFORE_EACH = NULL;
+		cst_crash_defer_to(CST_CRASH_PIPE[1]);
+		cst_memcheck_test_start();
+		cst_allocfail_test_start(copy.timeout);
+		cst_profile_test_start();
+		cst_impact_test_start();
+		cst_time_test_start();
+		cst_tmpdir_test_start();
+		if (copy.fuzz_func != NULL)
+			cst_fuzz_run(copy.fuzz_func);
+		else if (copy.row_func == NULL)
+			copy.func();
+		else {
+			// Forks made by -allocfail run the rows too, but only this one reports them
+			CST_ROWS_STATE->pid = getpid();
+			cst_run_rows(&copy);
+		}
 		cst_check_leaks_before_exit();
+		cst_profile_test_end();
+		fflush(stdout);
+		if (copy.row_func != NULL)
+			_exit(EXIT_SUCCESS);
+		// Failed expectations only fail the test once it's over
+		if (__atomic_load_n(&CST_FAILED_CHECKS, __ATOMIC_RELAXED) != 0)
+			_exit(EXIT_FAILURE);
+		fprintf(stderr, CST_GREEN"✅ %s\n"CST_RES, CST_TEST_NAME);
 		_exit(EXIT_SUCCESS);
-	} else {
-		int ec = 0;
-		test->executed = true;
-		if (test->timeout < 0)
-			test->timeout = CST_TIMEOUT_MS;
-		if (test->timeout <= 0) {
-			waitpid(pid, &ec, 0);
-			return (ec == 0);
-		}
-		size_t start = cst_now_ms();
-		while (true) {
-			pid_t res = waitpid(pid, &ec, WNOHANG);
-			if (res == -1)
-				cst_exit("waitpid failed", 3);
-			else if (res > 0)
-				return (ec == 0);
-			if ((cst_now_ms() - start) >= (size_t) test->timeout) {
-				kill(pid, SIGKILL);
-				waitpid(pid, &ec, 0);
-				printf(CST_BRED"❌ %s "CST_GRAY"-"CST_RED" Timed out (%ld ms)\n"CST_RES, test->name, test->timeout);
-				return false;
-			}
-			usleep(50);
-		}
 	}
+	bool passed = cst_wait_test(test, pid);
+	cst_tmpdir_done();
+	if (test->row_func == NULL) {
+		*failed += !passed;
+		return (passed);
+	}
+	*failed += CST_ROWS_STATE->failed;
+	CST_ROWS_STATE->failed = 0;
+	if (CST_ROWS_STATE->next < test->count) {
+		// The row ended the child, by crashing or by a fatal assertion
+		CST_ROWS_STATE->next++;
+		(*failed)++;
+	} else if (!passed)
+		(*failed)++;
+	return (passed);
+}
+
+/* Returns the number of failed tests, which is the number of failed rows for a TEST_P */
+static size_t cst_run_test(cst_test *test)
+{
+	size_t	failed = 0;
+
+	if (test->timeout < 0)
+		test->timeout = CST_TIMEOUT_MS;
+	test->executed = true;
+	CST_PROPERTIES_RAN |= test->property;
+	cst_impact_test_begin();
+	if (test->fuzz_func != NULL) {
+		cst_fork_test(test, &failed);
+		cst_fuzz_report(test->name, test->fuzz_func, CST_LAST_STATUS);
+	} else if (test->row_func == NULL)
+		cst_fork_test(test, &failed);
+	else {
+		// Rows share a child, and the next child takes over from the row that ended it
+		*CST_ROWS_STATE = (cst_rows_state) { 0 };
+		while (CST_ROWS_STATE->next < test->count)
+			cst_fork_test(test, &failed);
+	}
+	cst_profile_test_done(test->category, test->name,
+		test->func != NULL ? test->func : (void (*)(void)) test->row_func);
+	cst_impact_test_done(test->category, test->name, test->file);
+	return (failed);
+}
+
+static size_t cst_count_tests(void)
+{
+	size_t	count = 0;
+
+	for (cst_test *test = CST_TESTS; test != NULL; test = test->next)
+		count++;
+	return (count);
+}
+
+/* Tests whose category or name contain the -filter text */
+static bool cst_filtered(cst_test *test)
+{
+	return (CST_FILTER == NULL || strstr(test->name, CST_FILTER) != NULL
+		|| strstr(test->category, CST_FILTER) != NULL);
+}
+
+/* Tests that match -filter, and that -changed impacts */
+static bool cst_selected(cst_test *test)
+{
+	return cst_filtered(test) && cst_impact_selected(test->category, test->name, test->file);
+}
+
+static bool cst_category_selected(const char *name)
+{
+	for (cst_test *test = CST_TESTS; test != NULL; test = test->next)
+		if (strcmp(name, test->category) == 0 && cst_selected(test))
+			return (true);
+	return (false);
 }
 
 static void cst_run_test_category(const char *name, size_t *failed)
 {
+	if (!cst_category_selected(name))
+		return;
 	printf("\n");
 	cst_run_hook(CST_BEFORE_ALL, name);
 	if (name[0] != '\0')
 		printf(CST_BBLUE "%s" CST_GRAY ":" CST_RES "\n", name);
 	for (cst_test *test = CST_TESTS; test != NULL; test = test->next) {
-		if (strcmp(name, test->category) == 0) {
+		if (strcmp(name, test->category) == 0 && cst_selected(test)) {
 			cst_run_hook(CST_BEFORE_EACH, name);
 			cst_run_hook(CST_BEFORE_EACH, NULL);
-			if (!cst_run_test(test))
-				(*failed)++;
+			*failed += cst_run_test(test);
 			cst_run_hook(CST_AFTER_EACH, name);
 			cst_run_hook(CST_AFTER_EACH, NULL);
 		}
@@ -211,12 +611,17 @@ static int	cst_run_tests()
 
 	cst_run_hook(CST_BEFORE_ALL, NULL);
 	for (cst_test *tmp = CST_TESTS; tmp != NULL; tmp = tmp->next)
-		total++;
+		total += cst_selected(tmp) ? tmp->count : 0;
 	cst_run_test_category("", &failed);
 	for (cst_test *test = CST_TESTS; test != NULL; test = test->next)
-		if (!test->executed)
+		if (!test->executed && cst_selected(test))
 			cst_run_test_category(test->category, &failed);
 	cst_run_hook(CST_AFTER_ALL, NULL);
+	cst_profile_finish();
+	cst_impact_finish();
+	if (failed != 0 && CST_PROPERTIES_RAN)
+		printf(CST_GRAY"\n🎲 "CST_BLUE"Properties ran with "CST_BBLUE"-seed=%llu"CST_RES"\n",
+			(unsigned long long) CST_SEED);
 	if (failed == 0)
 		printf(CST_BGREEN "\n✅ All %zu tests passed!", total);
 	else
@@ -225,6 +630,205 @@ static int	cst_run_tests()
 	return (failed);
 }
 
+/*
+ - Repeated runs (-repeat, -until-fail)
+ -
+ - Selected tests run again and again in the same runner, so BEFORE_ALL
+ - hooks run once and unrelated tests don't run at all. Each run's output
+ - goes to a scratch file, and only a test's first failure is shown.
+ */
+
+static double cst_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void cst_add_run(cst_run_stats *stats, double ms, bool failed)
+{
+	double delta = ms - stats->mean_ms;
+
+	stats->runs++;
+	stats->failures += failed;
+	stats->mean_ms += delta / stats->runs;
+	stats->m2 += delta * (ms - stats->mean_ms);
+	if (stats->runs == 1 || ms < stats->min_ms)
+		stats->min_ms = ms;
+	if (ms > stats->max_ms)
+		stats->max_ms = ms;
+}
+
+/* Runs `test` with its output in `scratch`, returns whether it failed */
+static bool cst_run_captured(cst_test *test, int scratch)
+{
+	int		out;
+	int		err;
+	double	start;
+	size_t	failed;
+
+	fflush(stdout);
+	fflush(stderr);
+	if (ftruncate(scratch, 0) == -1 || lseek(scratch, 0, SEEK_SET) == -1)
+		cst_exit("Failed to reset scratch output", 2);
+	out = dup(STDOUT_FILENO);
+	err = dup(STDERR_FILENO);
+	dup2(scratch, STDOUT_FILENO);
+	dup2(scratch, STDERR_FILENO);
+	start = cst_now_us();
+	cst_run_hook(CST_BEFORE_EACH, test->category);
+	cst_run_hook(CST_BEFORE_EACH, NULL);
+	failed = cst_run_test(test);
+	cst_run_hook(CST_AFTER_EACH, test->category);
+	cst_run_hook(CST_AFTER_EACH, NULL);
+	cst_add_run(&test->stats, (cst_now_us() - start) / 1e3, failed != 0);
+	fflush(stdout);
+	fflush(stderr);
+	dup2(out, STDOUT_FILENO);
+	dup2(err, STDERR_FILENO);
+	close(out);
+	close(err);
+	return (failed != 0);
+}
+
+static void cst_show_captured(int scratch)
+{
+	char	buf[4096];
+	ssize_t	n;
+
+	fflush(stdout);
+	lseek(scratch, 0, SEEK_SET);
+	while ((n = read(scratch, buf, sizeof(buf))) > 0)
+		if (write(STDOUT_FILENO, buf, n) != n)
+			break;
+}
+
+/* Newton's method, so the runner doesn't need libm */
+static double cst_sqrt(double x)
+{
+	double r = x > 1 ? x : 1;
+
+	if (x <= 0)
+		return (0);
+	for (int i = 0; i < 64 && r * r - x > x * 1e-12; i++)
+		r = (r + x / r) / 2;
+	return (r);
+}
+
+static void cst_print_run_stats(cst_test *test)
+{
+	cst_run_stats	*stats = &test->stats;
+	double			stddev = stats->runs > 1 ? cst_sqrt(stats->m2 / (stats->runs - 1)) : 0;
+
+	if (stats->failures == 0)
+		printf(CST_GREEN"  ✅ %s"CST_GRAY" - "CST_GREEN"0/%zu failed", test->name, stats->runs);
+	else
+		printf(CST_BRED"  ❌ %s"CST_GRAY" - "CST_RED"%zu/%zu failed (%.1f%%)", test->name,
+			stats->failures, stats->runs, 100.0 * stats->failures / stats->runs);
+	printf(CST_GRAY" - "CST_YELLOW"%.2fms ± %.2f"CST_GRAY" (%.2f to %.2f)"CST_RES"\n",
+		stats->mean_ms, stddev, stats->min_ms, stats->max_ms);
+}
+
+/* Fisher-Yates with xorshift, from the run's seed so an order can be replayed */
+static void cst_shuffle(cst_test **tests, size_t count, uint64_t *state)
+{
+	for (size_t i = count; i > 1; i--) {
+		*state ^= *state << 13;
+		*state ^= *state >> 7;
+		*state ^= *state << 17;
+		size_t j = *state % i;
+		cst_test *tmp = tests[i - 1];
+		tests[i - 1] = tests[j];
+		tests[j] = tmp;
+	}
+}
+
+static void cst_run_category_hooks(cst_test **tests, size_t count, cst_hook *hooks)
+{
+	for (size_t i = 0; i < count; i++) {
+		bool first = true;
+		for (size_t j = 0; j < i && first; j++)
+			first = strcmp(tests[j]->category, tests[i]->category) != 0;
+		if (first)
+			cst_run_hook(hooks, tests[i]->category);
+	}
+}
+
+static int	cst_repeat_tests(void)
+{
+	char		scratch_path[] = "/tmp/cst-repeat-XXXXXX";
+	cst_test	**tests;
+	size_t		count = 0;
+	size_t		rounds = 0;
+	size_t		flaky = 0;
+	bool		stop = false;
+	uint64_t	order = CST_SEED | 1;
+	int			scratch = mkstemp(scratch_path);
+
+	if (scratch == -1)
+		cst_exit("Failed to create scratch output", 2);
+	unlink(scratch_path);
+	for (cst_test *test = CST_TESTS; test != NULL; test = test->next)
+		count += cst_selected(test);
+	if (count == 0) {
+		// Name the flag that left nothing to repeat
+		for (cst_test *test = CST_TESTS; test != NULL; test = test->next)
+			if (cst_filtered(test))
+				cst_exit("No tests are impacted by -changed", 1);
+		cst_exit(CST_FILTER != NULL ? "No tests match -filter" : "No tests to repeat", 1);
+	}
+	tests = cst_malloc(count * sizeof(cst_test *));
+	count = 0;
+	for (cst_test *test = CST_TESTS; test != NULL; test = test->next)
+		if (cst_selected(test))
+			tests[count++] = test;
+	printf(CST_GRAY"\n🔁 "CST_BLUE"Repeating %zu test(s) %s"CST_RES, count, CST_UNTIL_FAIL ? "until one fails" : "");
+	if (CST_REPEAT != 0)
+		printf(CST_BLUE"%s%zu time(s)"CST_RES, CST_UNTIL_FAIL ? ", at most " : "", CST_REPEAT);
+	if (CST_SHUFFLE)
+		printf(CST_BLUE", shuffled with "CST_BBLUE"-seed=%llu"CST_RES, (unsigned long long) CST_SEED);
+	printf("\n");
+	cst_run_hook(CST_BEFORE_ALL, NULL);
+	cst_run_category_hooks(tests, count, CST_BEFORE_ALL);
+	while (!stop && (CST_REPEAT == 0 || rounds < CST_REPEAT)) {
+		rounds++;
+		if (CST_SHUFFLE)
+			cst_shuffle(tests, count, &order);
+		// Each round explores properties from its own seed
+		cst_property_init(CST_SEED + rounds - 1, CST_PROP_RUNS);
+		for (size_t i = 0; i < count && !stop; i++) {
+			if (!cst_run_captured(tests[i], scratch))
+				continue;
+			if (tests[i]->stats.failures == 1) {
+				printf(CST_GRAY"\n🔁 "CST_BLUE"First failure of "CST_BBLUE"%s"CST_BLUE" (Round %zu):"CST_RES"\n",
+					tests[i]->name, rounds);
+				cst_show_captured(scratch);
+			}
+			stop = CST_UNTIL_FAIL;
+		}
+	}
+	cst_run_category_hooks(tests, count, CST_AFTER_ALL);
+	cst_run_hook(CST_AFTER_ALL, NULL);
+	cst_profile_finish();
+	cst_impact_finish();
+	close(scratch);
+	printf(CST_GRAY"\n🔁 "CST_BLUE"%zu round(s):"CST_RES"\n", rounds);
+	for (cst_test *test = CST_TESTS; test != NULL; test = test->next) {
+		if (!cst_selected(test) || test->stats.runs == 0)
+			continue;
+		cst_print_run_stats(test);
+		flaky += test->stats.failures != 0;
+	}
+	free(tests);
+	if (flaky == 0)
+		printf(CST_BGREEN "\n✅ All %zu tests passed %zu time(s)!", count, rounds);
+	else
+		printf(CST_BRED "\n❌ Failed " CST_BYELLOW "%zu" CST_GRAY "/" CST_YELLOW "%zu" CST_BRED " test(s)", flaky, count);
+	printf(CST_GRAY " - " CST_YELLOW "%zums" CST_RES "\n", (cst_now_ms() - CST_START_DATE));
+	return (flaky);
+}
+
 /*
  - Hook registration
  */
@@ -274,27 +878,76 @@ void cst_register_before_each(const char *category, void (*func)(void))
  - Test registration
  */
 
-void cst_register_test(const char *category, const char *name, long timeout, void (*func)(void))
+/* Tests run in registration order, the tail keeps appending constant */
+static void cst_add_test(cst_test *test)
+{
+	static cst_test	*tail = NULL;
+
+	if (CST_TESTS == NULL)
+		CST_TESTS = test;
+	else
+		tail->next = test;
+	tail = test;
+}
+
+static cst_test *cst_new_test(const char *category, const char *name, long timeout, const char *file)
 {
 	cst_test	*test;
 
 	test = cst_malloc(sizeof(cst_test));
 	test->category = category == NULL ? "" : category;
 	test->name = name == NULL ? "???" : name;
+	test->file = file == NULL ? "" : file;
 	test->timeout = timeout;
-	test->func = func;
+	test->func = NULL;
+	test->row_func = NULL;
+	test->fuzz_func = NULL;
+	test->rows = NULL;
+	test->count = 1;
+	test->property = false;
 	test->executed = false;
 	test->next = NULL;
-	if (CST_TESTS == NULL)
-		CST_TESTS = test;
-	else {
-		for (cst_test *tmp = CST_TESTS; true; tmp = tmp->next) {
-			if (tmp->next == NULL) {
-				tmp->next = test;
-				break;
-			}
-		}
-	}
+	return (test);
+}
+
+void cst_register_test(const char *category, const char *name, long timeout, void (*func)(void), const char *file)
+{
+	cst_test	*test;
+
+	test = cst_new_test(category, name, timeout, file);
+	test->func = func;
+	cst_add_test(test);
+}
+
+void cst_register_test_p(const char *category, const char *name, long timeout,
+	const void *rows, size_t count, void (*func)(const void *rows, size_t index), const char *file)
+{
+	cst_test	*test;
+
+	test = cst_new_test(category, name, timeout, file);
+	test->row_func = func;
+	test->rows = rows;
+	test->count = count;
+	cst_add_test(test);
+}
+
+void cst_register_property(const char *category, const char *name, void (*func)(void), const char *file)
+{
+	cst_test	*test;
+
+	test = cst_new_test(category, name, -1, file);
+	test->func = func;
+	test->property = true;
+	cst_add_test(test);
+}
+
+void cst_register_fuzz(const char *category, const char *name, void (*func)(const uint8_t *data, size_t len), const char *file)
+{
+	cst_test	*test;
+
+	test = cst_new_test(category, name, -1, file);
+	test->fuzz_func = func;
+	cst_add_test(test);
 }
 
 /*
@@ -311,25 +964,111 @@ static void get_timeout(const char *timeout)
 	CST_TIMEOUT_MS = ms < 0 ? 0 : ms;
 }
 
+static unsigned long long get_number(const char *value, const char *error)
+{
+	if (value[0] == '\0')
+		cst_exit((char *) error, 1);
+	for (size_t i = 0; value[i] != '\0'; i++)
+		if (!isdigit(value[i]))
+			cst_exit((char *) error, 1);
+	return strtoull(value, NULL, 10);
+}
+
 int main(int argc, char **argv)
 {
+	struct timespec	now;
+
 	CST_START_DATE = cst_now_ms();
+	clock_gettime(CLOCK_REALTIME, &now);
+	CST_SEED = ((uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec) ^ ((uint64_t) getpid() << 32);
 	if (CST_TESTS == NULL)
 		cst_exit("No tests to run", 1);
 	for (int i = 1; i < argc; i++) {
 		char *arg = argv[i];
 		if (strcmp(arg, "-nomem") == 0 || strcmp(arg, "-nomemcheck") == 0)
 			CST_MEMCHECK = false;
+		else if (strcmp(arg, "-memall") == 0 || strcmp(arg, "-memcheckall") == 0)
+			CST_MEMCHECK_ALL = true;
+		else if (strcmp(arg, "-memstats") == 0)
+			CST_MEMSTATS = true;
+		else if (strcmp(arg, "-memguard") == 0)
+			CST_MEMGUARD = true;
+		else if (strcmp(arg, "-memstacks") == 0)
+			CST_MEMSTACKS = true;
+		else if (strcmp(arg, "-allocfail") == 0)
+			CST_ALLOCFAIL = true;
+		else if (strcmp(arg, "-profile") == 0)
+			CST_PROFILE = "cst-profile.folded";
+		else if (strncmp(arg, "-profile=", 9) == 0 && arg[9] != '\0')
+			CST_PROFILE = arg + 9;
+		else if (strncmp(arg, "-seed=", 6) == 0)
+			CST_SEED = get_number(arg + 6, "Invalid -seed value. Zero or a positive number is required");
+		else if (strncmp(arg, "-prop-runs=", 11) == 0) {
+			CST_PROP_RUNS = (long) get_number(arg + 11, "Invalid -prop-runs value. A positive number is required");
+			if (CST_PROP_RUNS <= 0)
+				cst_exit("Invalid -prop-runs value. A positive number is required", 1);
+		}
+		else if (strcmp(arg, "-fuzz") == 0)
+			CST_FUZZ_SECONDS = 10;
+		else if (strncmp(arg, "-fuzz=", 6) == 0)
+			CST_FUZZ_SECONDS = (long) get_number(arg + 6, "Invalid -fuzz value. A number of seconds is required");
+		else if (strncmp(arg, "-corpus=", 8) == 0 && arg[8] != '\0')
+			CST_CORPUS = arg + 8;
+		else if (strncmp(arg, "-filter=", 8) == 0 && arg[8] != '\0')
+			CST_FILTER = arg + 8;
+		else if (strncmp(arg, "-repeat=", 8) == 0)
+			CST_REPEAT = get_number(arg + 8, "Invalid -repeat value. A positive number is required");
+		else if (strcmp(arg, "-until-fail") == 0)
+			CST_UNTIL_FAIL = true;
+		else if (strcmp(arg, "-shuffle") == 0)
+			CST_SHUFFLE = true;
+		else if (strcmp(arg, "-impact") == 0)
+			CST_IMPACT = true;
+		else if (strncmp(arg, "-impact=", 8) == 0 && arg[8] != '\0') {
+			CST_IMPACT = true;
+			CST_IMPACT_PATH = arg + 8;
+		} else if (strncmp(arg, "-impact-index=", 14) == 0 && arg[14] != '\0')
+			CST_IMPACT_PATH = arg + 14;
+		else if (strncmp(arg, "-changed=", 9) == 0 && arg[9] != '\0')
+			CST_CHANGED = arg + 9;
+		else if (strcmp(arg, "-virtual-time") == 0)
+			CST_VIRTUAL_TIME = true;
+		else if (strcmp(arg, "-pin") == 0)
+			CST_PIN = true;
+		else if (strcmp(arg, "-perturb") == 0)
+			CST_PERTURB = true;
+		else if (strcmp(arg, "-update-snapshots") == 0)
+			CST_UPDATE_SNAPSHOTS = true;
 		else if (strcmp(arg, "-nobt") == 0 || strcmp(arg, "-nobacktrace") == 0)
 			CST_DO_BACKTRACE = false;
 		else if (strcmp(arg, "-nosig") == 0 || strcmp(arg, "-nosighandler") == 0)
 			CST_SIGHANDLER = false;
-		else if (strcmp(arg, "-timeout=") == 0)
+		else if (strncmp(arg, "-timeout=", 9) == 0)
 			get_timeout(arg + 9);
 		else
 			printf(CST_GRAY"["CST_BYELLOW"CST"CST_GRAY"] "CST_YELLOW"Ignored unknown argument"CST_GRAY": "CST_BYELLOW"%s"CST_RES"\n", arg);
 	}
+	if (CST_SHUFFLE && CST_REPEAT == 0 && !CST_UNTIL_FAIL)
+		printf(CST_GRAY"["CST_BYELLOW"CST"CST_GRAY"] "CST_YELLOW"Ignored "CST_BYELLOW"-shuffle"CST_YELLOW", it needs -repeat or -until-fail"CST_RES"\n");
+	cst_memcheck_init(CST_MEMCHECK, CST_MEMCHECK_ALL, CST_MEMSTATS, CST_MEMGUARD, CST_MEMSTACKS);
+	cst_allocfail_init(CST_ALLOCFAIL);
+	cst_profile_init(CST_PROFILE);
+	cst_property_init(CST_SEED, CST_PROP_RUNS);
+	cst_fuzz_init(CST_FUZZ_SECONDS, CST_CORPUS);
+	cst_snapshot_init(CST_UPDATE_SNAPSHOTS);
+	cst_concurrent_init(CST_PIN, CST_PERTURB, CST_SEED);
+	cst_time_init(CST_VIRTUAL_TIME);
+	cst_tmpdir_init();
+	cst_impact_init(CST_IMPACT_PATH, CST_IMPACT, CST_CHANGED, cst_count_tests());
+	CST_ROWS_STATE = mmap(NULL, sizeof(cst_rows_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (CST_ROWS_STATE == MAP_FAILED)
+		cst_exit("Failed to map shared memory", 2);
+	// Crashing tests send their crash to be reported here
+	if (pipe(CST_CRASH_PIPE) == 0)
+		fcntl(CST_CRASH_PIPE[0], F_SETFL, O_NONBLOCK);
 	if (CST_SIGHANDLER)
 		cst_init_sighandler();
+	if (CST_REPEAT != 0 || CST_UNTIL_FAIL)
+		cst_exit(NULL, cst_repeat_tests());
 	cst_exit(NULL, cst_run_tests());
 }
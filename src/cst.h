@@ -10,6 +10,12 @@
 /* bool type */
 #include <stdbool.h>
 
+/* uint8_t */
+#include <stdint.h>
+
+/* strlen */
+#include <string.h>
+
 /* fabsf, fabs & fabsl */
 #include <math.h>
 
@@ -17,7 +23,25 @@
 
 /* Global variables for configuration */
 
-extern char	*CST_TEST_NAME;
+/**
+ * @brief Name of the running test. On the worker threads of a
+ * `TEST_CONCURRENT`, it's the worker's own, "test [thread i]".
+ */
+char	**cst_test_name_slot(void);
+# define CST_TEST_NAME (*cst_test_name_slot())
+
+/* Category of the running test, "" when it has none */
+extern char	*CST_TEST_CATEGORY;
+
+/**
+ * @brief Scratch directory of the running test, created before it starts
+ * and removed with everything in it once the test is over. Each test gets
+ * its own, on a private tmpfs when CST may mount one, so tests can't see
+ * each other's files. It's also exported as `$CST_TMPDIR` and `$TMPDIR`
+ * from the start. `NULL` outside of tests, or if it couldn't be created.
+ */
+char	*cst_tmpdir(void);
+# define CST_TMPDIR (cst_tmpdir())
 
 /**
  * @brief Whether to display the default assertion failure details.
@@ -29,7 +53,7 @@ extern char	*CST_TEST_NAME;
 extern bool	CST_SHOW_FAIL_DETAILS;
 
 /**
- * @brief The tip to display if the next assertion fails. This can be
+ * @brief The tip to display if the next assertion fails, on this thread. This can be
  * used to provide detailed assertion fail descriptions to help
  * the developer fix the issue.
  * 
@@ -38,7 +62,7 @@ extern bool	CST_SHOW_FAIL_DETAILS;
  * 
  * Default: `NULL`
  */
-extern char	*CST_FAIL_TIP;
+extern __thread char	*CST_FAIL_TIP;
 
 extern bool	CST_DO_BACKTRACE;
 
@@ -50,6 +74,11 @@ extern bool	CST_DO_BACKTRACE;
 # define CST_MAX_BT 32
 #endif
 
+/* Frames kept per allocation with -memstacks */
+#ifndef CST_ALLOC_BT
+# define CST_ALLOC_BT 8
+#endif
+
 #ifndef CST_PATH_MAX
 # define CST_PATH_MAX 1024
 #endif
@@ -65,12 +94,47 @@ void* cst_calloc_impl(size_t nmemb, size_t size, const char *file, int line);
 void* cst_realloc_impl(void *ptr, size_t size, const char *file, int line);
 void cst_free_impl(void *ptr, const char *file, int line);
 
+// Allocation profiling
+
+/**
+ * @brief Allocation counters of the current test. These only include
+ * tracked allocations, that is, those made through the `malloc` macros,
+ * or any allocation if the `-memall` flag is used.
+ */
+typedef struct cst_alloc_stats {
+	size_t allocs;
+	size_t frees;
+	size_t bytes;
+	size_t live_bytes;
+	size_t peak_bytes;
+} cst_alloc_stats;
+
+typedef struct cst_alloc_scope {
+	size_t allocs;
+	size_t bytes;
+	size_t max;
+	const char *file;
+	int line;
+	bool done;
+} cst_alloc_scope;
+
+cst_alloc_stats cst_get_alloc_stats(void);
+cst_alloc_scope cst_alloc_scope_begin(size_t max, const char *file, int line);
+void cst_alloc_scope_end(cst_alloc_scope *scope);
+
 // Manual leak checking
 bool cst_has_leaks(void);
 void cst_print_leaks(void);
 void cst_reset_memcheck(void);
 void cst_check_leaks_before_exit(void);
 
+// Whether blocks have redzones and freed ones are quarantined (-memguard)
+bool cst_memguard_enabled(void);
+
+// Exit codes of tests failed by memcheck itself
+#define CST_EXIT_LEAK 3
+#define CST_EXIT_MEMERROR 4
+
 // Override malloc/free with tracking (unless disabled)
 #ifndef CST_NO_MEMCHECK
 # define malloc(size) cst_malloc_impl(size, __FILE__, __LINE__)
@@ -83,7 +147,8 @@ void cst_check_leaks_before_exit(void);
  - Test registration
  */
 
-void cst_register_test(const char *category, const char *name, long timeout, void (*func)(void));
+/* `file` is the one defining the test, see -changed */
+void cst_register_test(const char *category, const char *name, long timeout, void (*func)(void), const char *file);
 
 #define __CST_STRCAT_IMPL(a,b) a##b
 #define __CST_STRCAT(a,b) __CST_STRCAT_IMPL(a,b)
@@ -94,7 +159,7 @@ void cst_register_test(const char *category, const char *name, long timeout, voi
 	static void __CST_STRCAT(__cst_fn_, ID)(void); \
 	static void __attribute__((constructor)) \
 	__CST_STRCAT(__cst_ctor_, ID)(void) { \
-		cst_register_test((CAT), (NAME), (TIMEOUT), __CST_STRCAT(__cst_fn_, ID)); \
+		cst_register_test((CAT), (NAME), (TIMEOUT), __CST_STRCAT(__cst_fn_, ID), __FILE__); \
 	} \
 	static void __CST_STRCAT(__cst_fn_, ID)(void)
 
@@ -106,6 +171,172 @@ void cst_register_test(const char *category, const char *name, long timeout, voi
 
 #define TEST(...) __CST_GET_MACRO(__VA_ARGS__, __CST_TEST3, __CST_TEST2)(__VA_ARGS__)
 
+/*
+ - Test registration - Parameterized
+ */
+
+void cst_register_test_p(const char *category, const char *name, long timeout,
+	const void *rows, size_t count, void (*func)(const void *rows, size_t index), const char *file);
+
+#define __CST_TEST_P_IMPL(CAT, NAME, ROWS, COUNT, ID) \
+	static void __CST_STRCAT(__cst_fn_, ID)(__typeof__(&(ROWS)[0]) row, __attribute__((unused)) size_t row_index); \
+	static void __CST_STRCAT(__cst_row_, ID)(const void *rows, size_t index) { \
+		__CST_STRCAT(__cst_fn_, ID)((__typeof__(&(ROWS)[0])) rows + index, index); \
+	} \
+	static void __attribute__((constructor)) \
+	__CST_STRCAT(__cst_ctor_, ID)(void) { \
+		cst_register_test_p((CAT), (NAME), -1, (ROWS), (COUNT), __CST_STRCAT(__cst_row_, ID), __FILE__); \
+	} \
+	static void __CST_STRCAT(__cst_fn_, ID)(__typeof__(&(ROWS)[0]) row, __attribute__((unused)) size_t row_index)
+
+/**
+ * @brief Registers a test that runs once per row of `rows`, an array of
+ * `count` elements of any type. The body gets the current row as `row`
+ * (A pointer to it) and its index as `row_index`. Each row is reported as
+ * its own test, named after the test and the row index, and rows all run
+ * in the same process unless one of them crashes or fails an assertion.
+ * 
+ * ```c
+ * static const struct { char c; bool num; } rows[] = { {'1', true}, {'a', false} };
+ * 
+ * TEST_P("Chars", "cst_isnum", rows, CST_ROWS(rows)) {
+ *     ASSERT_INT_EQUALS(cst_isnum(row->c), row->num);
+ * }
+ * ```
+ */
+#define TEST_P(CAT, NAME, ROWS, COUNT) __CST_TEST_P_IMPL((CAT), (NAME), ROWS, (COUNT), __COUNTER__)
+
+/* Number of elements of an array, for TEST_P */
+#define CST_ROWS(array) (sizeof(array) / sizeof((array)[0]))
+
+/*
+ - Test registration - Properties
+ */
+
+void cst_register_property(const char *category, const char *name, void (*func)(void), const char *file);
+void cst_property_run(void (*body)(void));
+
+#define __CST_PROPERTY_IMPL(CAT, NAME, ID) \
+	static void __CST_STRCAT(__cst_prop_, ID)(void); \
+	static void __CST_STRCAT(__cst_fn_, ID)(void) { \
+		cst_property_run(__CST_STRCAT(__cst_prop_, ID)); \
+	} \
+	static void __attribute__((constructor)) \
+	__CST_STRCAT(__cst_ctor_, ID)(void) { \
+		cst_register_property((CAT), (NAME), __CST_STRCAT(__cst_fn_, ID), __FILE__); \
+	} \
+	static void __CST_STRCAT(__cst_prop_, ID)(void)
+
+/**
+ * @brief Registers a property: a test body that draws its inputs from the
+ * `cst_gen_*` generators and runs a thousand times (See `-prop-runs=N`)
+ * with different ones, in a single process. If a run fails, its inputs are
+ * shrunk to a minimal counterexample, which is replayed and reported along
+ * with the seed to replay the whole run with (`-seed=N`).
+ * 
+ * ```c
+ * PROPERTY("Chars", "cst_toupper keeps digits") {
+ *     char c = cst_gen_int('0', '9');
+ *     ASSERT_CHAR_EQUALS(cst_toupper(c), c);
+ * }
+ * ```
+ */
+#define PROPERTY(CAT, NAME) __CST_PROPERTY_IMPL((CAT), (NAME), __COUNTER__)
+
+/*
+ - Test registration - Concurrent
+ */
+
+/**
+ * @brief Runs `body` like `TEST_CONCURRENT` does, from a test, and returns
+ * once every worker is done, so the test can check the state they left.
+ *
+ * ```c
+ * TEST("Counter", "Increments from 8 threads") {
+ *     cst_concurrent_run(increment, 8, 100000);
+ *     ASSERT_ULONG_EQUALS(counter_get(&counter), 8 * 100000);
+ * }
+ * ```
+ */
+void cst_concurrent_run(void (*body)(size_t thread, size_t iteration), size_t threads, size_t iterations);
+
+#define __CST_CONCURRENT_IMPL(CAT, NAME, THREADS, ITERATIONS, ID) \
+	static void __CST_STRCAT(__cst_conc_, ID)(size_t thread, size_t iteration); \
+	static void __CST_STRCAT(__cst_fn_, ID)(void) { \
+		cst_concurrent_run(__CST_STRCAT(__cst_conc_, ID), (THREADS), (ITERATIONS)); \
+	} \
+	static void __attribute__((constructor)) \
+	__CST_STRCAT(__cst_ctor_, ID)(void) { \
+		cst_register_test((CAT), (NAME), -1, __CST_STRCAT(__cst_fn_, ID), __FILE__); \
+	} \
+	static void __CST_STRCAT(__cst_conc_, ID)(__attribute__((unused)) size_t thread, \
+		__attribute__((unused)) size_t iteration)
+
+/**
+ * @brief Registers a stress test whose body runs `iterations` times on
+ * each of `threads` threads, released together so they actually race.
+ * The body sees its worker's index as `thread`, and its `iteration`.
+ * Assertions can be used from any worker, failures are reported under
+ * the worker's name. The throughput of each worker is reported too.
+ *
+ * Run with `-pin` to pin workers to distinct CPUs, and with `-perturb`
+ * to make them yield at random between iterations.
+ *
+ * ```c
+ * TEST_CONCURRENT("Queue", "Push from 8 threads", 8, 100000) {
+ *     ASSERT_TRUE(queue_push(&queue, thread));
+ * }
+ * ```
+ */
+#define TEST_CONCURRENT(CAT, NAME, THREADS, ITERATIONS) \
+	__CST_CONCURRENT_IMPL((CAT), (NAME), (THREADS), (ITERATIONS), __COUNTER__)
+
+/*
+ - Test registration - Fuzzing
+ */
+
+void cst_register_fuzz(const char *category, const char *name, void (*func)(const uint8_t *data, size_t len), const char *file);
+
+#define __CST_FUZZ_IMPL(CAT, NAME, ID) \
+	static void __CST_STRCAT(__cst_fn_, ID)(const uint8_t *data, size_t len); \
+	static void __attribute__((constructor)) \
+	__CST_STRCAT(__cst_ctor_, ID)(void) { \
+		cst_register_fuzz((CAT), (NAME), __CST_STRCAT(__cst_fn_, ID), __FILE__); \
+	} \
+	static void __CST_STRCAT(__cst_fn_, ID)(__attribute__((unused)) const uint8_t *data, \
+		__attribute__((unused)) size_t len)
+
+/**
+ * @brief Registers a fuzz target, whose body gets an input as `data` and
+ * `len`. Every run replays the inputs saved for it (In `cst-corpus/`, see
+ * `-corpus=<dir>`), and with `-fuzz` (Or `-fuzz=<seconds>`), new inputs
+ * are generated from them for 10 seconds, guided by the coverage of code
+ * built with `-fsanitize-coverage=trace-pc-guard` (Or `trace-pc` with GCC).
+ * Inputs that crash, fail an assertion or leak are shrunk and saved.
+ * 
+ * ```c
+ * FUZZ("Parser", "parse_header") {
+ *     parse_header(data, len);
+ * }
+ * ```
+ */
+#define FUZZ(CAT, NAME) __CST_FUZZ_IMPL((CAT), (NAME), __COUNTER__)
+
+/*
+ - Property generators, values shrink towards zero (Or `min`), empty strings and arrays.
+ - Strings, bytes and arrays belong to CST and are freed after each run.
+ */
+
+long long cst_gen_int(long long min, long long max);
+unsigned long long cst_gen_uint(unsigned long long min, unsigned long long max);
+bool cst_gen_bool(void);
+double cst_gen_double(double min, double max);
+
+/* `charset` may be NULL for printable ASCII characters */
+char *cst_gen_str(size_t max_len, const char *charset);
+void *cst_gen_bytes(size_t *len, size_t max_len);
+int *cst_gen_int_array(size_t *len, size_t max_len, int min, int max);
+
 /*
  - Hooks - Before all
  */
@@ -174,75 +405,191 @@ void cst_register_after_each(const char *category, void (*func)(void));
  - Shared assertion logic
  */
 
-#define CST_ASSERT(expr, func, errmsg) do {\
-	if ((expr)) {\
+/**
+ * @brief Records a failed assertion. Fatal failures (`ASSERT_*`) end the
+ * test right away, others (`EXPECT_*`) let it run and fail it once over.
+ */
+void cst_assert_failed(bool fatal);
+
+/*
+ * What an assertion prints when it fails. Each assertion gets its own,
+ * built at compile time into the cst_checks table, so what's left inline
+ * is the check and a call to the reporter below.
+ */
+typedef struct cst_check_site {
+	const char	*func;
+	const char	*format;	// NULL if the assertion prints its own details
+	const char	*file;
+	int			line;
+	bool		fatal;
+} cst_check_site;
+
+/* Read-only once relocated, away from the code */
+#define __CST_SITE(fatal, func, format) \
+	static const cst_check_site cst_site \
+		__attribute__((section(".data.rel.ro.cst_checks"), aligned(sizeof(void *)))) = \
+		{ (func), (format), __FILE__, __LINE__, (fatal) }
+
+/* Prints the failure, with the site's details formatted from the arguments */
+__attribute__((cold, noinline))
+void cst_check_failed(const cst_check_site *site, ...);
+
+/* Starts printing a failure whose details aren't a format, see __CST_CHECK */
+__attribute__((cold, noinline))
+bool cst_check_details(void);
+
+/* Checks the format's arguments, without evaluating them */
+__attribute__((format(printf, 1, 2)))
+int cst_check_format(const char *format, ...);
+
+#define __CST_CHECK_FMT(fatal, expr, func, format, ...) do {\
+	if (__builtin_expect(!!(expr), 1)) {\
 		CST_FAIL_TIP = NULL;\
-		cst_check_leaks_before_exit();\
-		fprintf(stderr, CST_GREEN"✅ %s\n"CST_RES, CST_TEST_NAME);\
-		exit(EXIT_SUCCESS);\
+		break;\
 	}\
-	fprintf(stderr, CST_BRED"❌ %s"CST_RED, CST_TEST_NAME);\
-	if (CST_SHOW_FAIL_DETAILS) {\
-		fprintf(stderr, CST_GRAY": "CST_RED);\
-		errmsg;\
-		fprintf(stderr, " from %s", #func);\
+	(void) sizeof(cst_check_format(format, ##__VA_ARGS__));\
+	__CST_SITE(fatal, #func, format);\
+	cst_check_failed(&cst_site, ##__VA_ARGS__);\
+} while (0)
+
+/* `errmsg` is a statement printing the details, run on failure only */
+#define __CST_CHECK(fatal, expr, func, errmsg) do {\
+	if (__builtin_expect(!!(expr), 1)) {\
+		CST_FAIL_TIP = NULL;\
+		break;\
 	}\
-	if (CST_FAIL_TIP != NULL)\
-		fprintf(stderr, CST_GRAY" - "CST_RED"%s", CST_FAIL_TIP);\
-	fprintf(stderr, "\n"CST_RES);\
-	CST_FAIL_TIP = NULL;\
-	cst_check_leaks_before_exit();\
-	exit(EXIT_FAILURE);\
+	__CST_SITE(fatal, #func, NULL);\
+	if (cst_check_details())\
+		errmsg;\
+	cst_check_failed(&cst_site);\
 } while (0)
 
-#define CST_ASSERT_FREE(ptr, expr, func, errmsg) do {\
-	if ((expr)) {\
+/* Frees `ptr` once checked, whether the check passes or not */
+#define __CST_CHECK_FREE(fatal, ptr, expr, func, errmsg) do {\
+	if (__builtin_expect(!!(expr), 1)) {\
 		CST_FAIL_TIP = NULL;\
 		free((ptr));\
-		cst_check_leaks_before_exit();\
-		fprintf(stderr, CST_GREEN"✅ %s\n"CST_RES, CST_TEST_NAME);\
-		exit(EXIT_SUCCESS);\
+		break;\
 	}\
-	fprintf(stderr, CST_BRED"❌ %s"CST_RED, CST_TEST_NAME);\
-	if (CST_SHOW_FAIL_DETAILS) {\
-		fprintf(stderr, CST_GRAY": "CST_RED);\
+	__CST_SITE(fatal, #func, NULL);\
+	if (cst_check_details())\
 		errmsg;\
-		fprintf(stderr, " from %s", #func);\
-	}\
-	if (CST_FAIL_TIP != NULL)\
-		fprintf(stderr, CST_GRAY" - "CST_RED"%s", CST_FAIL_TIP);\
-	fprintf(stderr, "\n"CST_RES);\
-	CST_FAIL_TIP = NULL;\
 	free((ptr));\
-	cst_check_leaks_before_exit();\
-	exit(EXIT_FAILURE);\
+	cst_check_failed(&cst_site);\
 } while (0)
 
+#define CST_ASSERT(expr, func, errmsg) __CST_CHECK(true, expr, func, errmsg)
+#define CST_ASSERT_FREE(ptr, expr, func, errmsg) __CST_CHECK_FREE(true, ptr, expr, func, errmsg)
+#define CST_EXPECT(expr, func, errmsg) __CST_CHECK(false, expr, func, errmsg)
+#define CST_EXPECT_FREE(ptr, expr, func, errmsg) __CST_CHECK_FREE(false, ptr, expr, func, errmsg)
+
+/*
+ - Assertions - Allocations
+ */
+
+/**
+ * @brief Asserts that the block following this macro performs at most
+ * `max` tracked allocations. The test fails once the block ends if it
+ * exceeds them, and continues otherwise. Leaving the block with `break`,
+ * `return` or `goto` skips the check.
+ * 
+ * ```c
+ * ASSERT_MAX_ALLOCS(1) {
+ *     handle_request(&req);
+ * }
+ * ```
+ * 
+ * @param max The maximum amount of allocations allowed in the block.
+ */
+#define ASSERT_MAX_ALLOCS(max) \
+	for (cst_alloc_scope cst_scope = cst_alloc_scope_begin((max), __FILE__, __LINE__);\
+		!cst_scope.done; cst_alloc_scope_end(&cst_scope))
+
+/**
+ * @brief Asserts that the block following this macro performs no
+ * tracked allocations at all. See `ASSERT_MAX_ALLOCS`.
+ */
+#define ASSERT_NO_ALLOCS ASSERT_MAX_ALLOCS(0)
+
 /*
  - Utils - Strings
  */
 
 bool cst_str_equals(const char *s1, const char *s2);
 
+/*
+ - Utils - Buffers
+ */
+
+/* Index of the first mismatch, or the length when equal */
+size_t cst_mem_mismatch(const void *actual, const void *expected, size_t len);
+size_t cst_float_mismatch(const float *actual, const float *expected, size_t count, unsigned ulps, float rel);
+size_t cst_double_mismatch(const double *actual, const double *expected, size_t count, unsigned ulps, double rel);
+
+/* Print the failure, and the context around it below the assertion */
+void cst_mem_diff(const void *actual, const void *expected, size_t len, size_t at);
+void cst_int_diff(const int *actual, const int *expected, size_t count, size_t at);
+void cst_float_diff(const float *actual, const float *expected, size_t count, size_t at);
+void cst_double_diff(const double *actual, const double *expected, size_t count, size_t at);
+void cst_text_diff(const char *actual, const char *expected, size_t at);
+
+/*
+ - Utils - Snapshots
+ */
+
+size_t cst_snapshot_compare(const void *buf, size_t len, const char *name);
+void cst_snapshot_diff(const void *buf, size_t len, size_t at);
+
+/*
+ - Utils - Virtual time
+ */
+
+/**
+ * @brief Turns virtual time on for the rest of the test (Or for every test
+ * with `-virtual-time`). The test's clocks (`clock_gettime`, `time`,
+ * `gettimeofday`) then stand still, and only move when it sleeps: `sleep`,
+ * `usleep`, `nanosleep` and `clock_nanosleep` return at once, after moving
+ * them forward by the time slept. Test timeouts still run in real time.
+ * 
+ * ```c
+ * cst_virtual_time();
+ * time_t start = time(NULL);
+ * ASSERT_FALSE(retry_with_backoff(always_fails, 5));  // Sleeps 1, 2, 4 then 8s
+ * ASSERT_LONG_EQUALS(time(NULL) - start, 15);
+ * ```
+ */
+void cst_virtual_time(void);
+
 /*
  - Assertions - NULL
  */
 
-#define ASSERT_NULL(expr) CST_ASSERT(expr == NULL, expr, fprintf(stderr, "Got NOT NULL when expecting NULL"));
+#define __CST_NULL(fatal, expr) __CST_CHECK_FMT(fatal, (expr) == NULL, expr, "Got NOT NULL when expecting NULL")
+
+#define ASSERT_NULL(expr) __CST_NULL(true, expr)
+#define EXPECT_NULL(expr) __CST_NULL(false, expr)
 
-#define ASSERT_NOT_NULL(expr) CST_ASSERT(expr != NULL, expr, fprintf(stderr, "Got NULL when expecting NOT NULL"));
+#define __CST_NOT_NULL(fatal, expr) __CST_CHECK_FMT(fatal, (expr) != NULL, expr, "Got NULL when expecting NOT NULL")
+
+#define ASSERT_NOT_NULL(expr) __CST_NOT_NULL(true, expr)
+#define EXPECT_NOT_NULL(expr) __CST_NOT_NULL(false, expr)
 
 /*
  - Assertions - Bool
  */
 
+#define __CST_TRUE(fatal, expr) __CST_CHECK_FMT(fatal, expr, expr, "Got FALSE when expecting TRUE")
+
 /**
  * @brief Asserts that the provided `expr`ession is `true`.
  * If `expr` evaluates to `false`, the test will fail.
  * 
  * @param expr The expression to evaluate (Generally just a function call).
  */
-#define ASSERT_TRUE(expr) CST_ASSERT(expr, expr, fprintf(stderr, "Got FALSE when expecting TRUE"));
+#define ASSERT_TRUE(expr) __CST_TRUE(true, expr)
+#define EXPECT_TRUE(expr) __CST_TRUE(false, expr)
+
+#define __CST_FALSE(fatal, expr) __CST_CHECK_FMT(fatal, !(expr), expr, "Got TRUE when expecting FALSE")
 
 /**
  * @brief Asserts that the provided `expr`ession is `false`.
@@ -250,244 +597,450 @@ bool cst_str_equals(const char *s1, const char *s2);
  * 
  * @param expr The expression to evaluate (Generally just a function call).
  */
-#define ASSERT_FALSE(expr) CST_ASSERT(!expr, expr, fprintf(stderr, "Got TRUE when expecting FALSE"));
+#define ASSERT_FALSE(expr) __CST_FALSE(true, expr)
+#define EXPECT_FALSE(expr) __CST_FALSE(false, expr)
 
 /*
  - Assertions - Char
  */
 
-#define ASSERT_CHAR_EQUALS(expr, expected) do {\
+#define __CST_CHAR_EQUALS(fatal, expr, expected) do {\
 	char cst_actual = (expr);\
 	char cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got '%c' when expecting '%c'", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got '%c' when expecting '%c'", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_CHAR_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_CHAR_EQUALS(expr, expected) __CST_CHAR_EQUALS(true, expr, expected)
+#define EXPECT_CHAR_EQUALS(expr, expected) __CST_CHAR_EQUALS(false, expr, expected)
+
+#define __CST_CHAR_NOT_EQUALS(fatal, expr, expected) do {\
 	char cst_actual = (expr);\
 	char cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got '%c' when expecting NOT '%c'", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got '%c' when expecting NOT '%c'", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_UCHAR_EQUALS(expr, expected) do {\
+#define ASSERT_CHAR_NOT_EQUALS(expr, expected) __CST_CHAR_NOT_EQUALS(true, expr, expected)
+#define EXPECT_CHAR_NOT_EQUALS(expr, expected) __CST_CHAR_NOT_EQUALS(false, expr, expected)
+
+#define __CST_UCHAR_EQUALS(fatal, expr, expected) do {\
 	unsigned char cst_actual = (expr);\
 	unsigned char cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got '%u' when expecting '%u'", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got '%u' when expecting '%u'", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_UCHAR_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_UCHAR_EQUALS(expr, expected) __CST_UCHAR_EQUALS(true, expr, expected)
+#define EXPECT_UCHAR_EQUALS(expr, expected) __CST_UCHAR_EQUALS(false, expr, expected)
+
+#define __CST_UCHAR_NOT_EQUALS(fatal, expr, expected) do {\
 	unsigned char cst_actual = (expr);\
 	unsigned char cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got '%u' when expecting NOT '%u'", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got '%u' when expecting NOT '%u'", cst_actual, cst_expected);\
 } while (0)
 
+#define ASSERT_UCHAR_NOT_EQUALS(expr, expected) __CST_UCHAR_NOT_EQUALS(true, expr, expected)
+#define EXPECT_UCHAR_NOT_EQUALS(expr, expected) __CST_UCHAR_NOT_EQUALS(false, expr, expected)
+
 /*
  - Assertions - Int
  */
 
-#define ASSERT_INT_EQUALS(expr, expected) do {\
+#define __CST_INT_EQUALS(fatal, expr, expected) do {\
 	int cst_actual = (expr);\
 	int cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %i when expecting %i", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %i when expecting %i", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_INT_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_INT_EQUALS(expr, expected) __CST_INT_EQUALS(true, expr, expected)
+#define EXPECT_INT_EQUALS(expr, expected) __CST_INT_EQUALS(false, expr, expected)
+
+#define __CST_INT_NOT_EQUALS(fatal, expr, expected) do {\
 	int cst_actual = (expr);\
 	int cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %i when expecting NOT %i", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %i when expecting NOT %i", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_UINT_EQUALS(expr, expected) do {\
+#define ASSERT_INT_NOT_EQUALS(expr, expected) __CST_INT_NOT_EQUALS(true, expr, expected)
+#define EXPECT_INT_NOT_EQUALS(expr, expected) __CST_INT_NOT_EQUALS(false, expr, expected)
+
+#define __CST_UINT_EQUALS(fatal, expr, expected) do {\
 	unsigned int cst_actual = (expr);\
 	unsigned int cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %u when expecting %u", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %u when expecting %u", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_UINT_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_UINT_EQUALS(expr, expected) __CST_UINT_EQUALS(true, expr, expected)
+#define EXPECT_UINT_EQUALS(expr, expected) __CST_UINT_EQUALS(false, expr, expected)
+
+#define __CST_UINT_NOT_EQUALS(fatal, expr, expected) do {\
 	unsigned int cst_actual = (expr);\
 	unsigned int cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %u when expecting NOT %u", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %u when expecting NOT %u", cst_actual, cst_expected);\
 } while (0)
 
+#define ASSERT_UINT_NOT_EQUALS(expr, expected) __CST_UINT_NOT_EQUALS(true, expr, expected)
+#define EXPECT_UINT_NOT_EQUALS(expr, expected) __CST_UINT_NOT_EQUALS(false, expr, expected)
+
 /*
  - Assertions - Long
  */
 
-#define ASSERT_LONG_EQUALS(expr, expected) do {\
+#define __CST_LONG_EQUALS(fatal, expr, expected) do {\
 	long cst_actual = (expr);\
 	long cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %ld when expecting %ld", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %ld when expecting %ld", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_LONG_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_LONG_EQUALS(expr, expected) __CST_LONG_EQUALS(true, expr, expected)
+#define EXPECT_LONG_EQUALS(expr, expected) __CST_LONG_EQUALS(false, expr, expected)
+
+#define __CST_LONG_NOT_EQUALS(fatal, expr, expected) do {\
 	long cst_actual = (expr);\
 	long cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %ld when expecting NOT %ld", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %ld when expecting NOT %ld", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_ULONG_EQUALS(expr, expected) do {\
+#define ASSERT_LONG_NOT_EQUALS(expr, expected) __CST_LONG_NOT_EQUALS(true, expr, expected)
+#define EXPECT_LONG_NOT_EQUALS(expr, expected) __CST_LONG_NOT_EQUALS(false, expr, expected)
+
+#define __CST_ULONG_EQUALS(fatal, expr, expected) do {\
 	unsigned long cst_actual = (expr);\
 	unsigned long cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %lu when expecting %lu", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %lu when expecting %lu", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_ULONG_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_ULONG_EQUALS(expr, expected) __CST_ULONG_EQUALS(true, expr, expected)
+#define EXPECT_ULONG_EQUALS(expr, expected) __CST_ULONG_EQUALS(false, expr, expected)
+
+#define __CST_ULONG_NOT_EQUALS(fatal, expr, expected) do {\
 	unsigned long cst_actual = (expr);\
 	unsigned long cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %lu when expecting NOT %lu", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %lu when expecting NOT %lu", cst_actual, cst_expected);\
 } while (0)
 
+#define ASSERT_ULONG_NOT_EQUALS(expr, expected) __CST_ULONG_NOT_EQUALS(true, expr, expected)
+#define EXPECT_ULONG_NOT_EQUALS(expr, expected) __CST_ULONG_NOT_EQUALS(false, expr, expected)
+
 /*
  - Assertions - Long long
  */
 
-#define ASSERT_LLONG_EQUALS(expr, expected) do {\
+#define __CST_LLONG_EQUALS(fatal, expr, expected) do {\
 	long long cst_actual = (expr);\
 	long long cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %lld when expecting %lld", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %lld when expecting %lld", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_LLONG_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_LLONG_EQUALS(expr, expected) __CST_LLONG_EQUALS(true, expr, expected)
+#define EXPECT_LLONG_EQUALS(expr, expected) __CST_LLONG_EQUALS(false, expr, expected)
+
+#define __CST_LLONG_NOT_EQUALS(fatal, expr, expected) do {\
 	long long cst_actual = (expr);\
 	long long cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %lld when expecting NOT %lld", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %lld when expecting NOT %lld", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_ULLONG_EQUALS(expr, expected) do {\
+#define ASSERT_LLONG_NOT_EQUALS(expr, expected) __CST_LLONG_NOT_EQUALS(true, expr, expected)
+#define EXPECT_LLONG_NOT_EQUALS(expr, expected) __CST_LLONG_NOT_EQUALS(false, expr, expected)
+
+#define __CST_ULLONG_EQUALS(fatal, expr, expected) do {\
 	unsigned long long cst_actual = (expr);\
 	unsigned long long cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %llu when expecting %llu", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %llu when expecting %llu", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_ULLONG_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_ULLONG_EQUALS(expr, expected) __CST_ULLONG_EQUALS(true, expr, expected)
+#define EXPECT_ULLONG_EQUALS(expr, expected) __CST_ULLONG_EQUALS(false, expr, expected)
+
+#define __CST_ULLONG_NOT_EQUALS(fatal, expr, expected) do {\
 	unsigned long long cst_actual = (expr);\
 	unsigned long long cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %llu when expecting NOT %llu", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %llu when expecting NOT %llu", cst_actual, cst_expected);\
 } while (0)
 
+#define ASSERT_ULLONG_NOT_EQUALS(expr, expected) __CST_ULLONG_NOT_EQUALS(true, expr, expected)
+#define EXPECT_ULLONG_NOT_EQUALS(expr, expected) __CST_ULLONG_NOT_EQUALS(false, expr, expected)
+
 /*
  - Assertions - Short
  */
 
-#define ASSERT_SHORT_EQUALS(expr, expected) do {\
+#define __CST_SHORT_EQUALS(fatal, expr, expected) do {\
 	short cst_actual = (expr);\
 	short cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %hd when expecting %hd", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %hd when expecting %hd", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_SHORT_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_SHORT_EQUALS(expr, expected) __CST_SHORT_EQUALS(true, expr, expected)
+#define EXPECT_SHORT_EQUALS(expr, expected) __CST_SHORT_EQUALS(false, expr, expected)
+
+#define __CST_SHORT_NOT_EQUALS(fatal, expr, expected) do {\
 	short cst_actual = (expr);\
 	short cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %hd when expecting NOT %hd", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %hd when expecting NOT %hd", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_USHORT_EQUALS(expr, expected) do {\
+#define ASSERT_SHORT_NOT_EQUALS(expr, expected) __CST_SHORT_NOT_EQUALS(true, expr, expected)
+#define EXPECT_SHORT_NOT_EQUALS(expr, expected) __CST_SHORT_NOT_EQUALS(false, expr, expected)
+
+#define __CST_USHORT_EQUALS(fatal, expr, expected) do {\
 	unsigned short cst_actual = (expr);\
 	unsigned short cst_expected = (expected);\
-	CST_ASSERT(cst_actual == cst_expected, expr, fprintf(stderr, "Got %hu when expecting %hu", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %hu when expecting %hu", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_USHORT_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_USHORT_EQUALS(expr, expected) __CST_USHORT_EQUALS(true, expr, expected)
+#define EXPECT_USHORT_EQUALS(expr, expected) __CST_USHORT_EQUALS(false, expr, expected)
+
+#define __CST_USHORT_NOT_EQUALS(fatal, expr, expected) do {\
 	unsigned short cst_actual = (expr);\
 	unsigned short cst_expected = (expected);\
-	CST_ASSERT(cst_actual != cst_expected, expr, fprintf(stderr, "Got %hu when expecting NOT %hu", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_actual != cst_expected, expr, "Got %hu when expecting NOT %hu", cst_actual, cst_expected);\
 } while (0)
 
+#define ASSERT_USHORT_NOT_EQUALS(expr, expected) __CST_USHORT_NOT_EQUALS(true, expr, expected)
+#define EXPECT_USHORT_NOT_EQUALS(expr, expected) __CST_USHORT_NOT_EQUALS(false, expr, expected)
+
 /*
  - Assertions - Float
  */
 
-#define ASSERT_FLOAT_EQUALS_APPROX(expr, expected, tol) do {\
+#define __CST_FLOAT_EQUALS_APPROX(fatal, expr, expected, tol) do {\
 	float cst_actual = (expr);\
 	float cst_expected = (expected);\
-	CST_ASSERT(fabsf(cst_actual - cst_expected) <= (tol), expr, \
-		fprintf(stderr, "Got %f when expecting %f ± %f", cst_actual, cst_expected, tol));\
+	__CST_CHECK_FMT(fatal, fabsf(cst_actual - cst_expected) <= (tol), expr, \
+		"Got %f when expecting %f ± %f", cst_actual, cst_expected, tol);\
 } while (0)
 
+#define ASSERT_FLOAT_EQUALS_APPROX(expr, expected, tol) __CST_FLOAT_EQUALS_APPROX(true, expr, expected, tol)
+#define EXPECT_FLOAT_EQUALS_APPROX(expr, expected, tol) __CST_FLOAT_EQUALS_APPROX(false, expr, expected, tol)
+
 #define ASSERT_FLOAT_EQUALS(expr, expected) ASSERT_FLOAT_EQUALS_APPROX((expr), (expected), 1e-6f)
+#define EXPECT_FLOAT_EQUALS(expr, expected) EXPECT_FLOAT_EQUALS_APPROX((expr), (expected), 1e-6f)
 
-#define ASSERT_FLOAT_NOT_EQUALS_APPROX(expr, expected, tol) do {\
+#define __CST_FLOAT_NOT_EQUALS_APPROX(fatal, expr, expected, tol) do {\
 	float cst_actual = (expr);\
 	float cst_expected = (expected);\
-	CST_ASSERT(!(fabsf(cst_actual - cst_expected) <= (tol)), expr, \
-		fprintf(stderr, "Got %f when expecting NOT %f ± %f", cst_actual, cst_expected, tol));\
+	__CST_CHECK_FMT(fatal, !(fabsf(cst_actual - cst_expected) <= (tol)), expr, \
+		"Got %f when expecting NOT %f ± %f", cst_actual, cst_expected, tol);\
 } while (0)
 
+#define ASSERT_FLOAT_NOT_EQUALS_APPROX(expr, expected, tol) __CST_FLOAT_NOT_EQUALS_APPROX(true, expr, expected, tol)
+#define EXPECT_FLOAT_NOT_EQUALS_APPROX(expr, expected, tol) __CST_FLOAT_NOT_EQUALS_APPROX(false, expr, expected, tol)
+
 #define ASSERT_FLOAT_NOT_EQUALS(expr, expected) ASSERT_FLOAT_NOT_EQUALS_APPROX((expr), (expected), 1e-6f)
+#define EXPECT_FLOAT_NOT_EQUALS(expr, expected) EXPECT_FLOAT_NOT_EQUALS_APPROX((expr), (expected), 1e-6f)
 
 /*
  - Assertions - Double
  */
 
-#define ASSERT_DOUBLE_EQUALS_APPROX(expr, expected, tol) do {\
+#define __CST_DOUBLE_EQUALS_APPROX(fatal, expr, expected, tol) do {\
 	double cst_actual = (expr);\
 	double cst_expected = (expected);\
-	CST_ASSERT(fabs(cst_actual - cst_expected) <= (tol), expr, \
-		fprintf(stderr, "Got %lf when expecting %lf ± %lf", cst_actual, cst_expected, tol));\
+	__CST_CHECK_FMT(fatal, fabs(cst_actual - cst_expected) <= (tol), expr, \
+		"Got %lf when expecting %lf ± %lf", cst_actual, cst_expected, tol);\
 } while (0)
 
+#define ASSERT_DOUBLE_EQUALS_APPROX(expr, expected, tol) __CST_DOUBLE_EQUALS_APPROX(true, expr, expected, tol)
+#define EXPECT_DOUBLE_EQUALS_APPROX(expr, expected, tol) __CST_DOUBLE_EQUALS_APPROX(false, expr, expected, tol)
+
 #define ASSERT_DOUBLE_EQUALS(expr, expected) ASSERT_DOUBLE_EQUALS_APPROX((expr), (expected), 1e-12)
+#define EXPECT_DOUBLE_EQUALS(expr, expected) EXPECT_DOUBLE_EQUALS_APPROX((expr), (expected), 1e-12)
 
-#define ASSERT_DOUBLE_NOT_EQUALS_APPROX(expr, expected, tol) do {\
+#define __CST_DOUBLE_NOT_EQUALS_APPROX(fatal, expr, expected, tol) do {\
 	double cst_actual = (expr);\
 	double cst_expected = (expected);\
-	CST_ASSERT(!(fabs(cst_actual - cst_expected) <= (tol)), expr, \
-		fprintf(stderr, "Got %lf when expecting %lf ± %lf", cst_actual, cst_expected, tol));\
+	__CST_CHECK_FMT(fatal, !(fabs(cst_actual - cst_expected) <= (tol)), expr, \
+		"Got %lf when expecting %lf ± %lf", cst_actual, cst_expected, tol);\
 } while (0)
 
+#define ASSERT_DOUBLE_NOT_EQUALS_APPROX(expr, expected, tol) __CST_DOUBLE_NOT_EQUALS_APPROX(true, expr, expected, tol)
+#define EXPECT_DOUBLE_NOT_EQUALS_APPROX(expr, expected, tol) __CST_DOUBLE_NOT_EQUALS_APPROX(false, expr, expected, tol)
+
 #define ASSERT_DOUBLE_NOT_EQUALS(expr, expected) ASSERT_DOUBLE_NOT_EQUALS_APPROX((expr), (expected), 1e-12)
+#define EXPECT_DOUBLE_NOT_EQUALS(expr, expected) EXPECT_DOUBLE_NOT_EQUALS_APPROX((expr), (expected), 1e-12)
 
 /*
  - Assertions - Long double
  */
 
-#define ASSERT_LDOUBLE_EQUALS_APPROX(expr, expected, tol) do {\
+#define __CST_LDOUBLE_EQUALS_APPROX(fatal, expr, expected, tol) do {\
 	long double cst_actual = (expr);\
 	long double cst_expected = (expected);\
-	CST_ASSERT(fabsl(cst_actual - cst_expected) <= (tol), expr, \
-		fprintf(stderr, "Got %Lf when expecting %Lf ± %Lf", cst_actual, cst_expected, tol));\
+	__CST_CHECK_FMT(fatal, fabsl(cst_actual - cst_expected) <= (tol), expr, \
+		"Got %Lf when expecting %Lf ± %Lf", cst_actual, cst_expected, tol);\
 } while (0)
 
+#define ASSERT_LDOUBLE_EQUALS_APPROX(expr, expected, tol) __CST_LDOUBLE_EQUALS_APPROX(true, expr, expected, tol)
+#define EXPECT_LDOUBLE_EQUALS_APPROX(expr, expected, tol) __CST_LDOUBLE_EQUALS_APPROX(false, expr, expected, tol)
+
 #define ASSERT_LDOUBLE_EQUALS(expr, expected) ASSERT_LDOUBLE_EQUALS_APPROX((expr), (expected), 1e-15L)
+#define EXPECT_LDOUBLE_EQUALS(expr, expected) EXPECT_LDOUBLE_EQUALS_APPROX((expr), (expected), 1e-15L)
 
-#define ASSERT_LDOUBLE_NOT_EQUALS_APPROX(expr, expected, tol) do {\
+#define __CST_LDOUBLE_NOT_EQUALS_APPROX(fatal, expr, expected, tol) do {\
 	long double cst_actual = (expr);\
 	long double cst_expected = (expected);\
-	CST_ASSERT(!(fabsl(cst_actual - cst_expected) <= (tol)), expr, \
-		fprintf(stderr, "Got %Lf when expecting %Lf ± %Lf", cst_actual, cst_expected, tol));\
+	__CST_CHECK_FMT(fatal, !(fabsl(cst_actual - cst_expected) <= (tol)), expr, \
+		"Got %Lf when expecting %Lf ± %Lf", cst_actual, cst_expected, tol);\
 } while (0)
 
+#define ASSERT_LDOUBLE_NOT_EQUALS_APPROX(expr, expected, tol) __CST_LDOUBLE_NOT_EQUALS_APPROX(true, expr, expected, tol)
+#define EXPECT_LDOUBLE_NOT_EQUALS_APPROX(expr, expected, tol) __CST_LDOUBLE_NOT_EQUALS_APPROX(false, expr, expected, tol)
+
 #define ASSERT_LDOUBLE_NOT_EQUALS(expr, expected) ASSERT_LDOUBLE_NOT_EQUALS_APPROX((expr), (expected), 1e-15L)
+#define EXPECT_LDOUBLE_NOT_EQUALS(expr, expected) EXPECT_LDOUBLE_NOT_EQUALS_APPROX((expr), (expected), 1e-15L)
 
 /*
  - Assertions - String
  */
 
-#define ASSERT_STR_EQUALS(expr, expected) do {\
+#define __CST_STR_EQUALS(fatal, expr, expected) do {\
 	char *cst_actual = (expr);\
 	char *cst_expected = (expected);\
-	CST_ASSERT(cst_str_equals(cst_actual, cst_expected), expr, fprintf(stderr, "Got \"%s\" when expecting \"%s\"", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, cst_str_equals(cst_actual, cst_expected), expr, "Got \"%s\" when expecting \"%s\"", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_STR_EQUALS_FREE(expr, expected) do {\
+#define ASSERT_STR_EQUALS(expr, expected) __CST_STR_EQUALS(true, expr, expected)
+#define EXPECT_STR_EQUALS(expr, expected) __CST_STR_EQUALS(false, expr, expected)
+
+#define __CST_STR_EQUALS_FREE(fatal, expr, expected) do {\
 	char *cst_actual = (expr);\
 	char *cst_expected = (expected);\
 	bool cst_result = cst_str_equals(cst_actual, cst_expected);\
-	CST_ASSERT_FREE(cst_actual, cst_result, expr, fprintf(stderr, "Got \"%s\" when expecting \"%s\"", cst_actual, cst_expected));\
+	__CST_CHECK_FREE(fatal, cst_actual, cst_result, expr, fprintf(stderr, "Got \"%s\" when expecting \"%s\"", cst_actual, cst_expected));\
 } while (0)
 
-#define ASSERT_STR_NOT_EQUALS(expr, expected) do {\
+#define ASSERT_STR_EQUALS_FREE(expr, expected) __CST_STR_EQUALS_FREE(true, expr, expected)
+#define EXPECT_STR_EQUALS_FREE(expr, expected) __CST_STR_EQUALS_FREE(false, expr, expected)
+
+#define __CST_STR_NOT_EQUALS(fatal, expr, expected) do {\
 	char *cst_actual = (expr);\
 	char *cst_expected = (expected);\
-	CST_ASSERT(!(cst_str_equals(cst_actual, cst_expected)), expr, fprintf(stderr, "Got \"%s\" when expecting NOT \"%s\"", cst_actual, cst_expected));\
+	__CST_CHECK_FMT(fatal, !(cst_str_equals(cst_actual, cst_expected)), expr, "Got \"%s\" when expecting NOT \"%s\"", cst_actual, cst_expected);\
 } while (0)
 
-#define ASSERT_STR_NOT_EQUALS_FREE(expr, expected) do {\
+#define ASSERT_STR_NOT_EQUALS(expr, expected) __CST_STR_NOT_EQUALS(true, expr, expected)
+#define EXPECT_STR_NOT_EQUALS(expr, expected) __CST_STR_NOT_EQUALS(false, expr, expected)
+
+#define __CST_STR_NOT_EQUALS_FREE(fatal, expr, expected) do {\
 	char *cst_actual = (expr);\
 	char *cst_expected = (expected);\
 	bool cst_result = !cst_str_equals(cst_actual, cst_expected);\
-	CST_ASSERT_FREE(cst_actual, cst_result, expr, fprintf(stderr, "Got \"%s\" when expecting NOT \"%s\"", cst_actual, cst_expected));\
+	__CST_CHECK_FREE(fatal, cst_actual, cst_result, expr, fprintf(stderr, "Got \"%s\" when expecting NOT \"%s\"", cst_actual, cst_expected));\
 } while (0)
 
+#define ASSERT_STR_NOT_EQUALS_FREE(expr, expected) __CST_STR_NOT_EQUALS_FREE(true, expr, expected)
+#define EXPECT_STR_NOT_EQUALS_FREE(expr, expected) __CST_STR_NOT_EQUALS_FREE(false, expr, expected)
+
+/*
+ - Assertions - Buffers
+ */
+
+/**
+ * @brief Asserts that `len` bytes at `expr` and `expected` are equal,
+ * printing a hex dump around the first differing byte otherwise.
+ */
+#define __CST_MEM_EQUALS(fatal, expr, expected, len) do {\
+	const void *cst_actual = (expr);\
+	const void *cst_expected = (expected);\
+	size_t cst_len = (len);\
+	size_t cst_at = cst_mem_mismatch(cst_actual, cst_expected, cst_len);\
+	__CST_CHECK(fatal, cst_at == cst_len, expr, cst_mem_diff(cst_actual, cst_expected, cst_len, cst_at));\
+} while (0)
+
+#define ASSERT_MEM_EQUALS(expr, expected, len) __CST_MEM_EQUALS(true, expr, expected, len)
+#define EXPECT_MEM_EQUALS(expr, expected, len) __CST_MEM_EQUALS(false, expr, expected, len)
+
+#define __CST_INT_ARRAY_EQUALS(fatal, expr, expected, count) do {\
+	const int *cst_actual = (expr);\
+	const int *cst_expected = (expected);\
+	size_t cst_count = (count);\
+	size_t cst_at = cst_mem_mismatch(cst_actual, cst_expected, cst_count * sizeof(int)) / sizeof(int);\
+	__CST_CHECK(fatal, cst_at == cst_count, expr, cst_int_diff(cst_actual, cst_expected, cst_count, cst_at));\
+} while (0)
+
+#define ASSERT_INT_ARRAY_EQUALS(expr, expected, count) __CST_INT_ARRAY_EQUALS(true, expr, expected, count)
+#define EXPECT_INT_ARRAY_EQUALS(expr, expected, count) __CST_INT_ARRAY_EQUALS(false, expr, expected, count)
+
+/**
+ * @brief Float arrays match element-wise within `ulps` representable
+ * values, or within `rel` times the larger magnitude for the `_REL`
+ * variants. NaN matches NaN.
+ */
+#define __CST_FLOAT_ARRAY_EQUALS(fatal, expr, expected, count, ulps, rel) do {\
+	const float *cst_actual = (expr);\
+	const float *cst_expected = (expected);\
+	size_t cst_count = (count);\
+	size_t cst_at = cst_float_mismatch(cst_actual, cst_expected, cst_count, (ulps), (rel));\
+	__CST_CHECK(fatal, cst_at == cst_count, expr, cst_float_diff(cst_actual, cst_expected, cst_count, cst_at));\
+} while (0)
+
+#define ASSERT_FLOAT_ARRAY_EQUALS_ULP(expr, expected, count, ulps) __CST_FLOAT_ARRAY_EQUALS(true, expr, expected, count, ulps, 0)
+#define EXPECT_FLOAT_ARRAY_EQUALS_ULP(expr, expected, count, ulps) __CST_FLOAT_ARRAY_EQUALS(false, expr, expected, count, ulps, 0)
+#define ASSERT_FLOAT_ARRAY_EQUALS_REL(expr, expected, count, rel) __CST_FLOAT_ARRAY_EQUALS(true, expr, expected, count, 0, rel)
+#define EXPECT_FLOAT_ARRAY_EQUALS_REL(expr, expected, count, rel) __CST_FLOAT_ARRAY_EQUALS(false, expr, expected, count, 0, rel)
+
+#define ASSERT_FLOAT_ARRAY_EQUALS(expr, expected, count) ASSERT_FLOAT_ARRAY_EQUALS_ULP((expr), (expected), (count), 4)
+#define EXPECT_FLOAT_ARRAY_EQUALS(expr, expected, count) EXPECT_FLOAT_ARRAY_EQUALS_ULP((expr), (expected), (count), 4)
+
+#define __CST_DOUBLE_ARRAY_EQUALS(fatal, expr, expected, count, ulps, rel) do {\
+	const double *cst_actual = (expr);\
+	const double *cst_expected = (expected);\
+	size_t cst_count = (count);\
+	size_t cst_at = cst_double_mismatch(cst_actual, cst_expected, cst_count, (ulps), (rel));\
+	__CST_CHECK(fatal, cst_at == cst_count, expr, cst_double_diff(cst_actual, cst_expected, cst_count, cst_at));\
+} while (0)
+
+#define ASSERT_DOUBLE_ARRAY_EQUALS_ULP(expr, expected, count, ulps) __CST_DOUBLE_ARRAY_EQUALS(true, expr, expected, count, ulps, 0)
+#define EXPECT_DOUBLE_ARRAY_EQUALS_ULP(expr, expected, count, ulps) __CST_DOUBLE_ARRAY_EQUALS(false, expr, expected, count, ulps, 0)
+#define ASSERT_DOUBLE_ARRAY_EQUALS_REL(expr, expected, count, rel) __CST_DOUBLE_ARRAY_EQUALS(true, expr, expected, count, 0, rel)
+#define EXPECT_DOUBLE_ARRAY_EQUALS_REL(expr, expected, count, rel) __CST_DOUBLE_ARRAY_EQUALS(false, expr, expected, count, 0, rel)
+
+#define ASSERT_DOUBLE_ARRAY_EQUALS(expr, expected, count) ASSERT_DOUBLE_ARRAY_EQUALS_ULP((expr), (expected), (count), 4)
+#define EXPECT_DOUBLE_ARRAY_EQUALS(expr, expected, count) EXPECT_DOUBLE_ARRAY_EQUALS_ULP((expr), (expected), (count), 4)
+
+/**
+ * @brief Like `ASSERT_STR_EQUALS` for large strings: only the text
+ * around the first difference is printed, with its line and column.
+ * NULL only equals NULL.
+ */
+#define __CST_TEXT_EQUALS(fatal, expr, expected) do {\
+	const char *cst_actual = (expr);\
+	const char *cst_expected = (expected);\
+	if (cst_actual == NULL || cst_expected == NULL) {\
+		__CST_CHECK_FMT(fatal, cst_actual == cst_expected, expr, "Got %s when expecting %s",\
+			cst_actual == NULL ? "NULL" : "text", cst_expected == NULL ? "NULL" : "text");\
+		break;\
+	}\
+	size_t cst_len = strlen(cst_actual) + 1;\
+	size_t cst_expected_len = strlen(cst_expected) + 1;\
+	size_t cst_at = cst_mem_mismatch(cst_actual, cst_expected, cst_len < cst_expected_len ? cst_len : cst_expected_len);\
+	__CST_CHECK(fatal, cst_at == cst_len && cst_len == cst_expected_len, expr, cst_text_diff(cst_actual, cst_expected, cst_at));\
+} while (0)
+
+#define ASSERT_TEXT_EQUALS(expr, expected) __CST_TEXT_EQUALS(true, expr, expected)
+#define EXPECT_TEXT_EQUALS(expr, expected) __CST_TEXT_EQUALS(false, expr, expected)
+
+/*
+ - Assertions - Snapshots
+ */
+
+/**
+ * @brief Asserts that `len` bytes at `expr` match the snapshot `name` of
+ * the running test, stored in cst-snapshots/<category>/<test>/<name>.
+ * Running with `-update-snapshots` writes missing snapshots and
+ * rewrites differing ones instead of failing.
+ */
+#define __CST_MATCHES_SNAPSHOT(fatal, expr, len, name) do {\
+	const void *cst_actual = (expr);\
+	size_t cst_len = (len);\
+	size_t cst_at = cst_snapshot_compare(cst_actual, cst_len, (name));\
+	__CST_CHECK(fatal, cst_at == (size_t) -1, expr, cst_snapshot_diff(cst_actual, cst_len, cst_at));\
+} while (0)
+
+#define ASSERT_MATCHES_SNAPSHOT(expr, len, name) __CST_MATCHES_SNAPSHOT(true, expr, len, name)
+#define EXPECT_MATCHES_SNAPSHOT(expr, len, name) __CST_MATCHES_SNAPSHOT(false, expr, len, name)
+
 /*
  - Colors
  */
@@ -0,0 +1,285 @@
+#define CST_NO_MEMCHECK  // Bookkeeping isn't part of the test
+#include "cst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+/*
+ - Allocation failure injection (-allocfail)
+ -
+ - Instead of running a test once per allocation it makes, the test runs
+ - once, and forks right before each of its tracked allocations. The fork
+ - sees that allocation fail and runs the rest of the test from there,
+ - while the original process goes on, so failure paths are explored in
+ - parallel. Forks that crash, leak, hang or misuse memory are reported.
+ -
+ - Only allocations made by the test's main thread are failed, as other
+ - threads don't survive a fork.
+ -
+ - Each fork gets the test's timeout of its own. The time the test spends
+ - waiting for its forks is shared with the runner, which doesn't count it
+ - against the test's timeout.
+ */
+
+void	*__libc_realloc(void *ptr, size_t size);
+void	__libc_free(void *ptr);
+
+/* Failure points explored per test, at most */
+#define CST_MAX_INJECTIONS 4096
+
+typedef struct cst_injection {
+	pid_t pid;
+	size_t index;
+	const char *file;
+	int line;
+	void *caller;
+	int status;
+} cst_injection;
+
+bool cst_allocfail_enabled = false;
+
+static bool g_active = false;
+static bool g_injected = false;
+static pid_t g_main_tid = 0;
+static __thread pid_t t_tid = 0;
+static long g_timeout_ms = 0;
+static long g_max_running = 1;
+static cst_injection *g_injections = NULL;
+static size_t g_count = 0;
+static size_t g_reaped = 0;
+static size_t *g_waited_ms = NULL;
+
+/*
+ - From cst_memcheck.c
+ */
+
+extern __thread int	cst_memcheck_depth;
+
+/*
+ - From cst_backtrace.c
+ */
+
+bool	cst_bt_resolve(void *addr, char *buf, size_t size);
+
+/*
+ - From cst_tmpdir.c
+ */
+
+void	cst_tmpdir_injected(size_t index);
+
+/*
+ - From cst_time.c
+ */
+
+int		cst_real_clock_gettime(clockid_t clock, struct timespec *ts);
+
+/*
+ - Helper: Waiting for injected forks, oldest first
+ */
+
+static size_t now_ms(void)
+{
+	struct timespec ts;
+
+	cst_real_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + (ts.tv_nsec / 1000000);
+}
+
+static void reap_one(void)
+{
+	cst_injection *inj = &g_injections[g_reaped++];
+	size_t start = now_ms();
+
+	while (waitpid(inj->pid, &inj->status, 0) == -1) {
+		if (errno != EINTR) {
+			inj->status = 0;  // Reaped by the test itself
+			break;
+		}
+	}
+	if (g_waited_ms != NULL)
+		__atomic_add_fetch(g_waited_ms, now_ms() - start, __ATOMIC_RELAXED);
+}
+
+/*
+ - Helper: The fork that sees the allocation fail
+ */
+
+static void become_injected(size_t index)
+{
+	int devnull = open("/dev/null", O_WRONLY);
+	int crashes[] = { SIGABRT, SIGFPE, SIGILL, SIGSEGV, SIGBUS };
+
+	g_injected = true;
+	// Crashes must reach the original test process as signals
+	for (size_t i = 0; i < sizeof(crashes) / sizeof(crashes[0]); i++)
+		signal(crashes[i], SIG_DFL);
+	// Results are reported by the original test process, keep this one quiet
+	if (devnull != -1) {
+		dup2(devnull, STDOUT_FILENO);
+		dup2(devnull, STDERR_FILENO);
+		close(devnull);
+	}
+	if (g_timeout_ms > 0) {
+		struct itimerval timer = {0};
+		timer.it_value.tv_sec = g_timeout_ms / 1000;
+		timer.it_value.tv_usec = (g_timeout_ms % 1000) * 1000;
+		signal(SIGALRM, SIG_DFL);
+		setitimer(ITIMER_REAL, &timer, NULL);
+	}
+	cst_tmpdir_injected(index);
+}
+
+/*
+ - Internal API: Called by memcheck for every tracked allocation.
+ - Returns true if this allocation must fail.
+ */
+
+bool cst_allocfail_inject(const char *file, int line, void *caller)
+{
+	if (!g_active || g_injected)
+		return false;
+	if (t_tid == 0)
+		t_tid = (pid_t) syscall(SYS_gettid);
+	if (t_tid != g_main_tid)
+		return false;
+	if (g_count == CST_MAX_INJECTIONS)
+		return false;
+	if (g_injections == NULL) {
+		g_injections = __libc_realloc(NULL, CST_MAX_INJECTIONS * sizeof(cst_injection));
+		if (g_injections == NULL)
+			return false;
+	}
+	while (g_count - g_reaped >= (size_t) g_max_running)
+		reap_one();
+
+	size_t index = g_count + 1;
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == -1)
+		return false;
+	if (pid == 0) {
+		become_injected(index);
+		return true;
+	}
+	g_injections[g_count++] = (cst_injection) {
+		.pid = pid,
+		.index = index,
+		.file = file,
+		.line = line,
+		.caller = caller,
+		.status = 0
+	};
+	return false;
+}
+
+/*
+ - Helper: Describe how an injected fork ended, NULL if it was fine
+ */
+
+static const char *describe_outcome(int status, char *buf, size_t size)
+{
+	if (WIFSIGNALED(status)) {
+		if (WTERMSIG(status) == SIGALRM)
+			return "timed out";
+		snprintf(buf, size, "crashed with signal %i (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+		return buf;
+	}
+	if (!WIFEXITED(status))
+		return NULL;
+	if (WEXITSTATUS(status) == CST_EXIT_LEAK)
+		return "leaked memory";
+	if (WEXITSTATUS(status) == CST_EXIT_MEMERROR)
+		return "misused memory (Invalid free or heap corruption)";
+	// Failed assertions are expected, the test may check for the failure
+	return NULL;
+}
+
+/*
+ - Internal API: Called once the test is over, fails it if any
+ - failure path was mishandled
+ */
+
+void cst_allocfail_finish(void)
+{
+	char outcome[128];
+	char where[CST_PATH_MAX];
+	size_t failed = 0;
+
+	if (!cst_allocfail_enabled || g_injected || g_injections == NULL)
+		return;
+	cst_memcheck_depth++;
+	while (g_reaped < g_count)
+		reap_one();
+	for (size_t i = 0; i < g_count; i++) {
+		cst_injection *inj = &g_injections[i];
+		const char *res = describe_outcome(inj->status, outcome, sizeof(outcome));
+		if (res == NULL)
+			continue;
+		if (failed++ == 0)
+			fprintf(stderr, CST_BRED"💥 %s "CST_GRAY"-"CST_RED" Allocation failures not handled"CST_GRAY":"CST_RES"\n",
+				CST_TEST_NAME);
+		if (inj->file != NULL)
+			snprintf(where, sizeof(where), "at %s:%d", inj->file, inj->line);
+		else if (cst_bt_resolve(inj->caller, where + 3, sizeof(where) - 3))
+			memcpy(where, "in ", 3);
+		else
+			snprintf(where, sizeof(where), "at %p", inj->caller);
+		fprintf(stderr, CST_GRAY"  - "CST_BRED"Allocation #%zu "CST_RED"%s "CST_GRAY"->"CST_RED" %s"CST_RES"\n",
+			inj->index, where, res);
+	}
+	if (failed > 0)
+		fprintf(stderr, CST_BRED"  Total: %zu of %zu failure path(s)"CST_RES"\n", failed, g_count);
+	__libc_free(g_injections);
+	g_injections = NULL;
+	cst_memcheck_depth--;
+	if (failed > 0)
+		exit(EXIT_FAILURE);
+}
+
+/*
+ - Internal API: Setup, called by cst.c
+ */
+
+void cst_allocfail_init(bool enabled)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	cst_allocfail_enabled = enabled;
+	g_max_running = cpus > 0 ? cpus : 1;
+	if (!enabled)
+		return;
+	g_waited_ms = mmap(NULL, sizeof(size_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (g_waited_ms == MAP_FAILED)
+		g_waited_ms = NULL;
+}
+
+/* Called by the runner before forking a test's child */
+void cst_allocfail_test_next(void)
+{
+	if (g_waited_ms != NULL)
+		__atomic_store_n(g_waited_ms, 0, __ATOMIC_RELAXED);
+}
+
+/* Time the current test spent waiting for its injected forks */
+size_t cst_allocfail_waited_ms(void)
+{
+	return g_waited_ms != NULL ? __atomic_load_n(g_waited_ms, __ATOMIC_RELAXED) : 0;
+}
+
+void cst_allocfail_test_start(long timeout_ms)
+{
+	g_active = cst_allocfail_enabled;
+	g_main_tid = (pid_t) syscall(SYS_gettid);
+	t_tid = g_main_tid;
+	g_timeout_ms = timeout_ms;
+}
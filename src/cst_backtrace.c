@@ -1,12 +1,21 @@
 #define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // backtrace_symbols() isn't tracked
 #include "cst.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <execinfo.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <dlfcn.h>
 
+/*
+ - From cst_symbolize.c
+ */
+
+bool	cst_sym_resolve(const char *path, uintptr_t offset, char *buf, size_t size);
+bool	cst_sym_function(const char *path, uintptr_t offset, char *buf, size_t size);
+
 typedef struct cst_backtrace {
 	int size;
 	void *addrs[CST_MAX_BT];
@@ -24,61 +33,90 @@ static void cst_bt_capture(cst_backtrace *bt, int skip) {
 	bt->size = n;
 }
 
-static bool resolve_with_addr2line(const char *binary, unsigned long addr) {
-	char cmd[CST_PATH_MAX];
-	snprintf(cmd, sizeof(cmd), "addr2line -f -p -e '%s' %lx 2>/dev/null", binary, addr);
-
-	FILE *fp = popen(cmd, "r");
-	if (fp == NULL)
-		return false;
+/* The executable's name is argv[0] as given, which may not be a path */
+static const char *module_path(const Dl_info *info) {
+	static char exe[CST_PATH_MAX];
 
-	char line[CST_PATH_MAX];
-	if (fgets(line, sizeof(line), fp) != NULL) {
-		size_t len = strlen(line);
-		if (len > 0 && line[len - 1] == '\n')
-			line[len - 1] = '\0';
-		fprintf(stderr, "    "CST_RED"%s"CST_RES"\n", line);
-		pclose(fp);
-		return true;
+	if (strchr(info->dli_fname, '/') != NULL)
+		return info->dli_fname;
+	if (exe[0] == '\0') {
+		ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+		exe[len > 0 ? len : 0] = '\0';
 	}
-	pclose(fp);
-	return false;
+	return exe[0] != '\0' ? exe : info->dli_fname;
 }
 
-static bool print_addr_module(void *addr) {
+/*
+ - Frame resolution, cached for the whole run: the runner resolves the
+ - backtraces of every crashed test, and tests are forks of it, so a frame
+ - is only symbolized once no matter how many tests crash through it.
+ */
+
+typedef struct cst_frame {
+	void *addr;
+	char *text;  // NULL if it couldn't be resolved
+} cst_frame;
+
+/* Must be a power of two */
+#define CST_FRAME_CACHE 4096
+
+static cst_frame *g_frames = NULL;
+static size_t g_frames_used = 0;
+
+static bool resolve_frame(void *addr, char *buf, size_t size) {
 	Dl_info info = {0};
 
-	if (!dladdr(addr, &info) || info.dli_fname == NULL || info.dli_fbase == NULL) {
-		char exep[CST_PATH_MAX];
-		ssize_t len = readlink("/proc/self/exe", exep, sizeof(exep) - 1);
-		if (len > 0)
-			exep[len] = '\0';
-		else
-			strcpy(exep, "/proc/self/exe");
-		return resolve_with_addr2line(exep, (unsigned long) addr);
-	}
+	if (!dladdr(addr, &info) || info.dli_fname == NULL || info.dli_fbase == NULL)
+		return false;
 
 	unsigned long base = (unsigned long)info.dli_fbase;
 	unsigned long a_mod = (unsigned long)addr - base;
 
-	if (resolve_with_addr2line(info.dli_fname, a_mod))
+	if (cst_sym_resolve(module_path(&info), a_mod, buf, size))
 		return true;
 	if (info.dli_sname != NULL) {
-		fprintf(stderr, CST_RED"    at %s (%p)"CST_RES"\n", info.dli_sname, addr);
+		snprintf(buf, size, "at %s (%p)", info.dli_sname, addr);
 		return true;
 	}
 	return false;
 }
 
+static const char *lookup_frame(void *addr, char *text, size_t size) {
+	size_t i = (size_t) (((uintptr_t) addr * 0x9E3779B97F4A7C15ULL) >> 40) & (CST_FRAME_CACHE - 1);
+
+	if (g_frames == NULL)
+		g_frames = calloc(CST_FRAME_CACHE, sizeof(cst_frame));
+	for (size_t probes = 0; g_frames != NULL && probes < CST_FRAME_CACHE; probes++) {
+		if (g_frames[i].addr == addr)
+			return g_frames[i].text;
+		if (g_frames[i].addr == NULL)
+			break;
+		i = (i + 1) & (CST_FRAME_CACHE - 1);
+	}
+	bool resolved = resolve_frame(addr, text, size);
+	// Half full at most, so probing stays short
+	if (g_frames == NULL || g_frames_used >= CST_FRAME_CACHE / 2 || g_frames[i].addr != NULL)
+		return resolved ? text : NULL;
+	g_frames[i].addr = addr;
+	g_frames[i].text = resolved ? strdup(text) : NULL;
+	g_frames_used++;
+	return g_frames[i].text;
+}
+
 static void cst_bt_print(const cst_backtrace *bt) {
 	if (bt == NULL || bt->size == 0) {
 		fprintf(stderr, "  <no backtrace>\n");
 		return;
 	}
+	char buf[CST_PATH_MAX];
 	bool resolved_any = false;
-	for (int i = 0; i < bt->size; ++i)
-		if (print_addr_module(bt->addrs[i]))
+	for (int i = 0; i < bt->size; ++i) {
+		const char *text = lookup_frame(bt->addrs[i], buf, sizeof(buf));
+		if (text != NULL) {
+			fprintf(stderr, "    "CST_RED"%s"CST_RES"\n", text);
 			resolved_any = true;
+		}
+	}
 	if (!resolved_any) {
 		char **syms = backtrace_symbols(bt->addrs, bt->size);
 		if (syms != NULL) {
@@ -89,6 +127,15 @@ static void cst_bt_print(const cst_backtrace *bt) {
 	}
 }
 
+/* Raw frames captured elsewhere, such as in a crashed test (See cst_sighandler.c) */
+void cst_bt_print_frames(void *const *addrs, int count) {
+	cst_backtrace bt = {0};
+
+	bt.size = count < CST_MAX_BT ? count : CST_MAX_BT;
+	memcpy(bt.addrs, addrs, bt.size * sizeof(void *));
+	cst_bt_print(&bt);
+}
+
 void cst_bt_print_current(int skip) {
 	if (!CST_DO_BACKTRACE)
 		return ;
@@ -96,3 +143,44 @@ void cst_bt_print_current(int skip) {
 	cst_bt_capture(&bt, skip + 1);
 	cst_bt_print(&bt);
 }
+
+/*
+ - Single address resolution, used by memcheck to locate allocations
+ - made outside of the malloc macros (See cst_interpose.c)
+ */
+
+bool cst_bt_resolve(void *addr, char *buf, size_t size) {
+	Dl_info info = {0};
+
+	if (addr == NULL || buf == NULL || size == 0)
+		return false;
+	if (!dladdr(addr, &info) || info.dli_fname == NULL || info.dli_fbase == NULL)
+		return false;
+	// Return addresses point past the call, step back into it
+	unsigned long a_mod = (unsigned long) addr - 1 - (unsigned long) info.dli_fbase;
+	if (cst_sym_resolve(module_path(&info), a_mod, buf, size) && strncmp(buf, "??", 2) != 0)
+		return true;
+	if (info.dli_sname != NULL) {
+		snprintf(buf, size, "%s+0x%lx (%s)", info.dli_sname,
+			(unsigned long) addr - (unsigned long) info.dli_saddr, info.dli_fname);
+		return true;
+	}
+	snprintf(buf, size, "%s+0x%lx", info.dli_fname, a_mod + 1);
+	return true;
+}
+
+/* Function name only, used by the profiler (See cst_profile.c) */
+bool cst_bt_function(void *addr, char *buf, size_t size) {
+	Dl_info info = {0};
+
+	if (addr == NULL || buf == NULL || size == 0)
+		return false;
+	if (!dladdr(addr, &info) || info.dli_fname == NULL || info.dli_fbase == NULL)
+		return false;
+	if (cst_sym_function(module_path(&info), (unsigned long) addr - (unsigned long) info.dli_fbase, buf, size))
+		return true;
+	if (info.dli_sname == NULL)
+		return false;
+	snprintf(buf, size, "%s", info.dli_sname);
+	return true;
+}
@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // Workers belong to CST, not to the test
+#include "cst.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ - Concurrent stress tests (TEST_CONCURRENT)
+ -
+ - The body runs on every worker thread, once per iteration. Workers are
+ - created first, then wait on a spin barrier and are all released at
+ - once, so they actually overlap instead of starting one after the other.
+ - Each worker names itself "test [thread i]", which is what its failed
+ - assertions and crashes are reported as.
+ -
+ - With -pin, workers are pinned to distinct CPUs when there are enough of
+ - them. With -perturb, they yield at random between iterations, which
+ - shakes up interleavings that are otherwise stable.
+ */
+
+/* Odds of yielding between two iterations with -perturb, as 1 in N */
+#define CST_PERTURB_ODDS 16
+
+typedef struct cst_worker {
+	pthread_t	thread;
+	size_t		index;
+	int			cpu;
+	uint64_t	rng;
+	double		seconds;
+	char		name[CST_PATH_MAX];
+} cst_worker;
+
+typedef struct cst_concurrent {
+	void		(*body)(size_t thread, size_t iteration);
+	size_t		iterations;
+	size_t		arrived;
+	bool		released;
+} cst_concurrent;
+
+void	*__libc_malloc(size_t size);
+void	__libc_free(void *ptr);
+
+static bool g_pin = false;
+static bool g_perturb = false;
+static uint64_t g_seed = 0;
+static cst_concurrent *g_run = NULL;
+
+static __thread int t_worker = -1;
+
+/*
+ - From cst.c
+ */
+
+void	cst_set_thread_name(char *name);
+
+/*
+ - From cst_time.c
+ */
+
+int		cst_real_clock_gettime(clockid_t clock, struct timespec *ts);
+
+void cst_concurrent_init(bool pin, bool perturb, uint64_t seed)
+{
+	g_pin = pin;
+	g_perturb = perturb;
+	g_seed = seed;
+}
+
+/* Index of the calling worker thread, -1 outside of workers */
+int cst_worker_index(void)
+{
+	return t_worker;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+
+	cst_real_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_main(void *arg)
+{
+	cst_worker *worker = arg;
+	cst_concurrent *run = g_run;
+	double start;
+
+	t_worker = (int) worker->index;
+	cst_set_thread_name(worker->name);
+	if (worker->cpu != -1) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+	__atomic_add_fetch(&run->arrived, 1, __ATOMIC_ACQ_REL);
+	while (!__atomic_load_n(&run->released, __ATOMIC_ACQUIRE))
+		cpu_relax();
+	start = now_seconds();
+	for (size_t i = 0; i < run->iterations; i++) {
+		run->body(worker->index, i);
+		if (!g_perturb)
+			continue;
+		worker->rng ^= worker->rng << 13;
+		worker->rng ^= worker->rng >> 7;
+		worker->rng ^= worker->rng << 17;
+		if (worker->rng % CST_PERTURB_ODDS == 0)
+			sched_yield();
+	}
+	worker->seconds = now_seconds() - start;
+	return NULL;
+}
+
+/* Distinct CPUs among those the test may run on, or -1 if too few */
+static void assign_cpus(cst_worker *workers, size_t count)
+{
+	cpu_set_t allowed;
+	size_t next = 0;
+
+	for (size_t i = 0; i < count; i++)
+		workers[i].cpu = -1;
+	if (!g_pin || sched_getaffinity(0, sizeof(allowed), &allowed) == -1
+		|| (size_t) CPU_COUNT(&allowed) < count)
+		return;
+	for (int cpu = 0; cpu < CPU_SETSIZE && next < count; cpu++)
+		if (CPU_ISSET(cpu, &allowed))
+			workers[next++].cpu = cpu;
+}
+
+/* "12.3M" */
+static void format_rate(char *buf, size_t size, double rate)
+{
+	if (rate >= 1e9)
+		snprintf(buf, size, "%.2fG", rate / 1e9);
+	else if (rate >= 1e6)
+		snprintf(buf, size, "%.2fM", rate / 1e6);
+	else if (rate >= 1e3)
+		snprintf(buf, size, "%.2fK", rate / 1e3);
+	else
+		snprintf(buf, size, "%.0f", rate);
+}
+
+static void report(const char *name, cst_worker *workers, size_t count, size_t iterations)
+{
+	char rate[32];
+	double total = 0;
+
+	for (size_t i = 0; i < count; i++)
+		total += workers[i].seconds > 0 ? iterations / workers[i].seconds : 0;
+	format_rate(rate, sizeof(rate), total);
+	fprintf(stderr, CST_GRAY"⚡ "CST_BLUE"%s"CST_GRAY" - "CST_BLUE"%zu thread(s) × %zu iteration(s), %s ops/s"CST_GRAY" (",
+		name, count, iterations, rate);
+	for (size_t i = 0; i < count; i++) {
+		format_rate(rate, sizeof(rate), workers[i].seconds > 0 ? iterations / workers[i].seconds : 0);
+		fprintf(stderr, "%s%s", i > 0 ? " " : "", rate);
+	}
+	fprintf(stderr, " per thread)"CST_RES"\n");
+}
+
+void cst_concurrent_run(void (*body)(size_t thread, size_t iteration), size_t threads, size_t iterations)
+{
+	cst_concurrent run = { .body = body, .iterations = iterations };
+	cst_worker *workers;
+	size_t started = 0;
+
+	if (threads == 0)
+		threads = 1;
+	workers = __libc_malloc(threads * sizeof(cst_worker));
+	if (workers == NULL) {
+		CST_FAIL_TIP = "Not enough memory for the workers";
+		CST_ASSERT(false, threads, fprintf(stderr, "Could not start %zu thread(s)", threads));
+	}
+	g_run = &run;
+	assign_cpus(workers, threads);
+	for (size_t i = 0; i < threads; i++) {
+		workers[i].index = i;
+		workers[i].seconds = 0;
+		workers[i].rng = (g_seed ^ (0x9E3779B97F4A7C15ULL * (i + 1))) | 1;
+		snprintf(workers[i].name, sizeof(workers[i].name), "%s [thread %zu]", CST_TEST_NAME, i);
+		if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+			break;
+		started++;
+	}
+	while (__atomic_load_n(&run.arrived, __ATOMIC_ACQUIRE) < started)
+		cpu_relax();
+	__atomic_store_n(&run.released, true, __ATOMIC_RELEASE);
+	for (size_t i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	g_run = NULL;
+	if (started == threads)
+		report(CST_TEST_NAME, workers, threads, iterations);
+	__libc_free(workers);
+	CST_EXPECT(started == threads, threads,
+		fprintf(stderr, "Could only start %zu of %zu thread(s)", started, threads));
+}
@@ -0,0 +1,506 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // The corpus belongs to CST, not to the target
+#include "cst.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ - Coverage-guided fuzzing (FUZZ)
+ -
+ - Code built with -fsanitize-coverage=trace-pc-guard (Clang) or
+ - -fsanitize-coverage=trace-pc (GCC) bumps an edge counter in a map shared
+ - with the runner. The target runs in a loop inside its test's process:
+ - mutated corpus inputs that reach new counters (Bucketed by hit count)
+ - join the corpus, and are saved to its directory.
+ -
+ - Findings are anything that ends the test: crashes, failed assertions,
+ - leaks and memory errors, all reported as usual. The runner then knows
+ - the input from the shared memory, shrinks it in fresh forks as long as
+ - it ends the same way, and saves it next to the corpus. Saved inputs are
+ - replayed by every run, fuzzing or not, so findings stay failures.
+ */
+
+void	*__libc_malloc(size_t size);
+void	__libc_free(void *ptr);
+
+/*
+ - From cst.c
+ */
+
+size_t	cst_failed_checks(void);
+
+/*
+ - From cst_memcheck.c
+ */
+
+void	cst_memcheck_test_start(void);
+
+/*
+ - From cst_impact.c
+ */
+
+extern bool	cst_impact_recording;
+void	cst_impact_hit(uintptr_t pc);
+
+/*
+ - From cst_time.c
+ */
+
+int		cst_real_clock_gettime(clockid_t clock, struct timespec *ts);
+
+/* Must be a power of two */
+#define CST_FUZZ_MAP (64 * 1024)
+
+#define CST_FUZZ_MAX_LEN 4096
+#define CST_FUZZ_CORPUS 4096
+
+/* Forks spent shrinking a finding, at most */
+#define CST_FUZZ_SHRINKS 512
+
+/* Seconds a single input may run while shrinking */
+#define CST_FUZZ_SHRINK_TIMEOUT 5
+
+typedef struct cst_fuzz_shared {
+	uint8_t map[CST_FUZZ_MAP];
+	size_t len;
+	uint8_t data[CST_FUZZ_MAX_LEN];
+	char path[CST_PATH_MAX];  // Corpus file of the input, if any
+	size_t runs;
+	size_t edges;
+	size_t corpus;
+} cst_fuzz_shared;
+
+typedef struct cst_input {
+	uint8_t *data;
+	size_t len;
+} cst_input;
+
+static long g_seconds = 0;
+static const char *g_dir = "cst-corpus";
+static cst_fuzz_shared *g_shared = NULL;
+static uint8_t *g_map = NULL;  // Only set while a target runs
+static uint8_t g_virgin[CST_FUZZ_MAP];
+static cst_input g_corpus[CST_FUZZ_CORPUS];
+static size_t g_corpus_len = 0;
+static uint64_t g_rng = 0;
+
+/*
+ - Coverage callbacks, called by instrumented code, also recording test
+ - impact (See cst_impact.c)
+ */
+
+void __sanitizer_cov_trace_pc_guard_init(uint32_t *start, uint32_t *stop)
+{
+	static uint32_t next = 0;
+
+	if (start == stop || *start != 0)
+		return;
+	for (uint32_t *guard = start; guard < stop; guard++)
+		*guard = 1 + next++ % (CST_FUZZ_MAP - 1);
+}
+
+void __sanitizer_cov_trace_pc_guard(uint32_t *guard)
+{
+	if (g_map != NULL)
+		g_map[*guard]++;
+	if (cst_impact_recording)
+		cst_impact_hit((uintptr_t) __builtin_return_address(0));
+}
+
+void __sanitizer_cov_trace_pc(void)
+{
+	uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+
+	if (g_map != NULL)
+		g_map[(pc ^ (pc >> 15)) & (CST_FUZZ_MAP - 1)]++;
+	if (cst_impact_recording)
+		cst_impact_hit(pc);
+}
+
+/*
+ - Helper: Inputs
+ */
+
+static uint64_t rng_next(void)
+{
+	g_rng ^= g_rng << 13;
+	g_rng ^= g_rng >> 7;
+	g_rng ^= g_rng << 17;
+	return g_rng;
+}
+
+static uint64_t input_hash(const uint8_t *data, size_t len)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ data[i]) * 0x100000001B3ULL;
+	return hash;
+}
+
+/* Each target has its own directory, named after the test */
+static void target_dir(char *buf, size_t size)
+{
+	size_t len = (size_t) snprintf(buf, size, "%s/", g_dir);
+
+	for (const char *c = CST_TEST_NAME; *c != '\0' && len + 1 < size; c++)
+		buf[len++] = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ? *c : '_';
+	buf[len < size ? len : size - 1] = '\0';
+}
+
+static bool corpus_add(const uint8_t *data, size_t len)
+{
+	uint8_t *copy;
+
+	if (g_corpus_len == CST_FUZZ_CORPUS || (copy = __libc_malloc(len == 0 ? 1 : len)) == NULL)
+		return false;
+	memcpy(copy, data, len);
+	g_corpus[g_corpus_len++] = (cst_input) { .data = copy, .len = len };
+	return true;
+}
+
+static bool save_input(const char *dir, const char *prefix, const uint8_t *data, size_t len, char *path, size_t size)
+{
+	int fd;
+
+	mkdir(g_dir, 0755);
+	mkdir(dir, 0755);
+	snprintf(path, size, "%s/%s%016llx", dir, prefix, (unsigned long long) input_hash(data, len));
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return false;
+	bool saved = write(fd, data, len) == (ssize_t) len;
+	close(fd);
+	return saved;
+}
+
+static size_t read_input(const char *path, uint8_t *buf)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t n;
+
+	if (fd == -1)
+		return 0;
+	n = read(fd, buf, CST_FUZZ_MAX_LEN);
+	close(fd);
+	return n > 0 ? (size_t) n : 0;
+}
+
+/*
+ - Helper: Running the target, ends the process if the input is a finding
+ */
+
+static void run_input(void (*body)(const uint8_t *, size_t), size_t len)
+{
+	size_t checks = cst_failed_checks();
+
+	g_shared->len = len;
+	g_map = g_shared->map;
+	body(g_shared->data, len);
+	g_map = NULL;
+	g_shared->runs++;
+	if (cst_failed_checks() != checks)
+		exit(EXIT_FAILURE);
+	if (cst_has_leaks()) {
+		cst_print_leaks();
+		exit(CST_EXIT_LEAK);
+	}
+}
+
+static const uint8_t g_buckets[256] = {
+	[0] = 0, [1] = 1, [2] = 2, [3] = 4, [4 ... 7] = 8, [8 ... 15] = 16,
+	[16 ... 31] = 32, [32 ... 127] = 64, [128 ... 255] = 128
+};
+
+/* Returns true if the last run reached new counters, clears the map */
+static bool new_coverage(void)
+{
+	uint64_t *words = (uint64_t *) g_shared->map;
+	bool found = false;
+
+	for (size_t w = 0; w < CST_FUZZ_MAP / sizeof(uint64_t); w++) {
+		if (words[w] == 0)
+			continue;
+		for (size_t i = w * sizeof(uint64_t); i < (w + 1) * sizeof(uint64_t); i++) {
+			uint8_t bucket = g_buckets[g_shared->map[i]];
+			if ((bucket & ~g_virgin[i]) != 0) {
+				g_shared->edges += g_virgin[i] == 0;
+				g_virgin[i] |= bucket;
+				found = true;
+			}
+		}
+		words[w] = 0;
+	}
+	return found;
+}
+
+/*
+ - Helper: Mutations, stacked a few at a time
+ */
+
+static size_t mutate(uint8_t *data, size_t len)
+{
+	static const uint8_t interesting[] = { 0, 1, 0x7F, 0x80, 0xFF, '0', 'a', ' ', '\n' };
+	size_t count = 1 + rng_next() % 4;
+
+	for (size_t m = 0; m < count; m++) {
+		size_t pos = len > 0 ? rng_next() % len : 0;
+		switch (rng_next() % 7) {
+			case 0:  // Flip a bit
+				if (len > 0)
+					data[pos] ^= 1 << (rng_next() % 8);
+				break;
+			case 1:  // Random byte
+				if (len > 0)
+					data[pos] = (uint8_t) rng_next();
+				break;
+			case 2:  // Interesting byte
+				if (len > 0)
+					data[pos] = interesting[rng_next() % sizeof(interesting)];
+				break;
+			case 3:  // Insert a byte
+				if (len < CST_FUZZ_MAX_LEN) {
+					memmove(data + pos + 1, data + pos, len - pos);
+					data[pos] = (uint8_t) rng_next();
+					len++;
+				}
+				break;
+			case 4:  // Delete bytes
+				if (len > 0) {
+					size_t n = 1 + rng_next() % (len - pos);
+					memmove(data + pos, data + pos + n, len - pos - n);
+					len -= n;
+				}
+				break;
+			case 5:  // Duplicate a chunk
+				if (len > 0 && len < CST_FUZZ_MAX_LEN) {
+					size_t n = 1 + rng_next() % (len - pos);
+					if (n > CST_FUZZ_MAX_LEN - len)
+						n = CST_FUZZ_MAX_LEN - len;
+					memmove(data + pos + n, data + pos, len - pos);
+					len += n;
+				}
+				break;
+			default: {  // Splice with another input
+				const cst_input *other = &g_corpus[rng_next() % g_corpus_len];
+				if (other->len > 0) {
+					size_t from = rng_next() % other->len;
+					size_t n = other->len - from;
+					if (n > CST_FUZZ_MAX_LEN - pos)
+						n = CST_FUZZ_MAX_LEN - pos;
+					memcpy(data + pos, other->data + from, n);
+					if (pos + n > len)
+						len = pos + n;
+				}
+				break;
+			}
+		}
+	}
+	return len;
+}
+
+/*
+ - Helper: Corpus loading, inputs that fail end the test right away
+ */
+
+static void load_corpus(void (*body)(const uint8_t *, size_t), const char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+
+	while (d != NULL && (entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (snprintf(g_shared->path, sizeof(g_shared->path), "%s/%s", dir, entry->d_name)
+			>= (int) sizeof(g_shared->path))
+			continue;
+		size_t len = read_input(g_shared->path, g_shared->data);
+		run_input(body, len);
+		new_coverage();
+		corpus_add(g_shared->data, len);
+	}
+	if (d != NULL)
+		closedir(d);
+	g_shared->path[0] = '\0';
+	if (g_corpus_len == 0) {
+		run_input(body, 0);
+		new_coverage();
+		corpus_add(g_shared->data, 0);
+	}
+}
+
+/*
+ - Internal API: Called by cst.c
+ */
+
+void cst_fuzz_init(long seconds, const char *dir)
+{
+	g_seconds = seconds;
+	if (dir != NULL)
+		g_dir = dir;
+	g_shared = mmap(NULL, sizeof(cst_fuzz_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (g_shared == MAP_FAILED)
+		g_shared = NULL;
+}
+
+/* Runs a FUZZ target in the test's process: its saved inputs, then new ones if fuzzing */
+void cst_fuzz_run(void (*body)(const uint8_t *, size_t))
+{
+	char dir[CST_PATH_MAX];
+	struct timespec ts;
+	time_t deadline;
+
+	if (g_shared == NULL)
+		return;
+	target_dir(dir, sizeof(dir));
+	memset(g_shared->map, 0, sizeof(g_shared->map));
+	g_shared->runs = 0;
+	g_shared->edges = 0;
+	load_corpus(body, dir);
+	if (g_seconds <= 0)
+		return;
+	cst_real_clock_gettime(CLOCK_MONOTONIC, &ts);
+	deadline = ts.tv_sec + g_seconds;
+	g_rng = input_hash((const uint8_t *) CST_TEST_NAME, strlen(CST_TEST_NAME)) ^ (uint64_t) ts.tv_nsec;
+	g_rng += g_rng == 0;
+	while (true) {
+		// Checking the time on each run would cost more than some targets
+		if ((g_shared->runs & 255) == 0) {
+			cst_real_clock_gettime(CLOCK_MONOTONIC, &ts);
+			if (ts.tv_sec >= deadline)
+				break;
+		}
+		const cst_input *base = &g_corpus[rng_next() % g_corpus_len];
+		memcpy(g_shared->data, base->data, base->len);
+		size_t len = mutate(g_shared->data, base->len);
+		run_input(body, len);
+		if (new_coverage() && corpus_add(g_shared->data, len)) {
+			char path[CST_PATH_MAX];
+			save_input(dir, "", g_shared->data, len, path, sizeof(path));
+		}
+		g_shared->corpus = g_corpus_len;
+	}
+}
+
+/*
+ - Helper: Shrinking a finding, each candidate runs in its own quiet fork
+ */
+
+static int run_quietly(void (*body)(const uint8_t *, size_t), const uint8_t *data, size_t len)
+{
+	int status = 0;
+	pid_t pid;
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid == -1)
+		return -1;
+	if (pid == 0) {
+		int devnull = open("/dev/null", O_WRONLY);
+		int crashes[] = { SIGABRT, SIGFPE, SIGILL, SIGSEGV, SIGBUS, SIGALRM };
+		if (devnull != -1) {
+			dup2(devnull, STDOUT_FILENO);
+			dup2(devnull, STDERR_FILENO);
+		}
+		// Crashes must end the fork with their signal, so they can be told apart
+		for (size_t i = 0; i < sizeof(crashes) / sizeof(crashes[0]); i++)
+			signal(crashes[i], SIG_DFL);
+		alarm(CST_FUZZ_SHRINK_TIMEOUT);
+		cst_memcheck_test_start();
+		memmove(g_shared->data, data, len);
+		run_input(body, len);
+		_exit(EXIT_SUCCESS);
+	}
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+		;
+	// As the runner keeps a crash, without the core dump bit
+	return WIFSIGNALED(status) ? WTERMSIG(status) : status;
+}
+
+static size_t shrink(void (*body)(const uint8_t *, size_t), uint8_t *data, size_t len, int status)
+{
+	uint8_t *candidate = __libc_malloc(CST_FUZZ_MAX_LEN);
+	size_t budget = CST_FUZZ_SHRINKS;
+
+	if (candidate == NULL)
+		return len;
+	// Chunks are removed, halving their size once none can be
+	for (size_t size = len / 2; size > 0 && budget > 0; size /= 2) {
+		for (size_t pos = 0; pos + size <= len && budget > 0; budget--) {
+			memcpy(candidate, data, pos);
+			memcpy(candidate + pos, data + pos + size, len - pos - size);
+			if (run_quietly(body, candidate, len - size) == status) {
+				len -= size;
+				memcpy(data, candidate, len);
+			} else
+				pos += size;
+		}
+	}
+	// Then bytes are made as plain as possible
+	for (size_t i = 0; i < len && budget > 0; i++) {
+		if (data[i] == '0' || data[i] == 0)
+			continue;
+		memcpy(candidate, data, len);
+		candidate[i] = '0';
+		budget--;
+		if (run_quietly(body, candidate, len) == status)
+			data[i] = '0';
+	}
+	__libc_free(candidate);
+	return len;
+}
+
+/*
+ - Internal API: Called by the runner once a FUZZ target is reaped
+ */
+
+void cst_fuzz_report(const char *name, void (*body)(const uint8_t *, size_t), int status)
+{
+	char dir[CST_PATH_MAX];
+	char path[CST_PATH_MAX];
+	uint8_t *data;
+	size_t len;
+	char *test_name = CST_TEST_NAME;
+
+	if (g_shared == NULL)
+		return;
+	if (status == 0) {
+		if (g_seconds > 0)
+			printf(CST_GRAY"🐛 "CST_BLUE"%s "CST_GRAY"-"CST_BLUE" %zu run(s), %zu edge(s), %zu input(s) in corpus"CST_RES"\n",
+				name, g_shared->runs, g_shared->edges, g_shared->corpus);
+		return;
+	}
+	if (g_shared->path[0] != '\0') {
+		printf(CST_GRAY"🐛 "CST_RED"Failing input"CST_GRAY": "CST_RED"%s"CST_RES"\n", g_shared->path);
+		return;
+	}
+	if ((data = __libc_malloc(CST_FUZZ_MAX_LEN)) == NULL)
+		return;
+	len = g_shared->len;
+	memcpy(data, g_shared->data, len);
+	CST_TEST_NAME = (char *) name;
+	target_dir(dir, sizeof(dir));
+	// The input must end the same way when run again, or it isn't the finding
+	if (run_quietly(body, data, len) != status)
+		printf(CST_GRAY"🐛 "CST_YELLOW"The last input doesn't fail the same way when run again, it wasn't saved"CST_RES"\n");
+	else {
+		size_t before = len;
+		len = shrink(body, data, len, status);
+		printf(CST_GRAY"🐛 "CST_RED"Input shrunk from %zu to %zu byte(s)"CST_RES"\n", before, len);
+		if (save_input(dir, "crash-", data, len, path, sizeof(path)))
+			printf(CST_GRAY"🐛 "CST_RED"Failing input saved to "CST_BRED"%s"CST_RES"\n", path);
+	}
+	CST_TEST_NAME = test_name;
+	__libc_free(data);
+}
@@ -0,0 +1,537 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // The index belongs to CST, not to the tests
+#include "cst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ - Test impact analysis (-impact, -changed)
+ -
+ - With -impact, code built with -fsanitize-coverage=trace-pc(-guard) or
+ - -finstrument-functions records the addresses it runs into a table shared
+ - with the runner, each address once per test. Once a test is reaped, the
+ - runner resolves them to functions and source files, and the run ends by
+ - writing them to the index (cst-impact.index), after the file defining
+ - the test:
+ -
+ -   test	<category>	<name>	<file>
+ -   	<function>	<file>
+ -
+ - With -changed=<list>, only the tests that touched one of the listed
+ - functions or files run, along with the tests defined in a listed file,
+ - and those the index doesn't know yet or has nothing for. Tests recorded
+ - again replace their entry, the others are kept as is.
+ */
+
+#define CST_IMPACT_INDEX "cst-impact.index"
+
+/* Must be a power of two, tests touching more than half of it match any change */
+#define CST_IMPACT_SLOTS (256 * 1024)
+#define CST_IMPACT_MAX (CST_IMPACT_SLOTS / 2)
+
+/* Resolved addresses kept for the whole run, must be a power of two */
+#define CST_IMPACT_SYMS (64 * 1024)
+
+typedef struct cst_impact_shared {
+	size_t count;
+	bool overflow;
+	uint32_t used[CST_IMPACT_MAX];
+	uintptr_t slots[CST_IMPACT_SLOTS];
+} cst_impact_shared;
+
+typedef struct cst_impact_test {
+	char *category;
+	char *name;
+	char *file;  // Defining the test
+	const char *lines;  // Its function lines in the loaded index
+	size_t lines_len;
+	char *recorded;  // Its function lines from this run
+	bool impacted;
+	struct cst_impact_test *chain;
+	struct cst_impact_test *next;  // In index order
+} cst_impact_test;
+
+typedef struct cst_impact_sym {
+	uintptr_t pc;
+	char *line;
+} cst_impact_sym;
+
+bool cst_impact_recording = false;
+
+static const char *g_path = CST_IMPACT_INDEX;
+static bool g_record = false;
+static char **g_changed = NULL;
+static size_t g_changed_count = 0;
+static bool g_indexed = false;
+static char *g_index = NULL;
+static cst_impact_shared *g_shared = NULL;
+static cst_impact_test **g_buckets = NULL;
+static size_t g_bucket_mask = 0;
+static cst_impact_test *g_first = NULL;
+static cst_impact_test *g_last = NULL;
+static cst_impact_sym *g_syms = NULL;
+static size_t g_syms_used = 0;
+
+/*
+ - From cst_backtrace.c
+ */
+
+bool	cst_bt_resolve(void *addr, char *buf, size_t size);
+
+/*
+ - Test side, called by instrumented code
+ */
+
+static inline size_t pc_slot(uintptr_t pc)
+{
+	return (size_t) (((uint64_t) pc * 0x9E3779B97F4A7C15ULL) >> 40) & (CST_IMPACT_SLOTS - 1);
+}
+
+void cst_impact_hit(uintptr_t pc)
+{
+	cst_impact_shared *shared = g_shared;
+
+	for (size_t i = pc_slot(pc); true; i = (i + 1) & (CST_IMPACT_SLOTS - 1)) {
+		uintptr_t seen = __atomic_load_n(&shared->slots[i], __ATOMIC_RELAXED);
+		if (seen == pc)
+			return;
+		if (seen != 0)
+			continue;
+		if (__atomic_load_n(&shared->count, __ATOMIC_RELAXED) >= CST_IMPACT_MAX) {
+			shared->overflow = true;
+			return;
+		}
+		if (!__atomic_compare_exchange_n(&shared->slots[i], &seen, pc, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			if (seen == pc)
+				return;
+			continue;
+		}
+		size_t n = __atomic_fetch_add(&shared->count, 1, __ATOMIC_RELAXED);
+		if (n < CST_IMPACT_MAX)
+			shared->used[n] = (uint32_t) i;
+		else
+			shared->overflow = true;
+		return;
+	}
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_enter(void *func, void *call_site)
+{
+	(void) call_site;
+	// Resolution steps back from return addresses, this one is the function itself
+	if (cst_impact_recording)
+		cst_impact_hit((uintptr_t) func + 1);
+}
+
+__attribute__((no_instrument_function))
+void __cyg_profile_func_exit(void *func, void *call_site)
+{
+	(void) func;
+	(void) call_site;
+}
+
+/* Called in the test's child, right before the test runs */
+void cst_impact_test_start(void)
+{
+	cst_impact_recording = g_shared != NULL;
+}
+
+/*
+ - Helper: Index
+ */
+
+static size_t key_hash(const char *category, const char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *category != '\0'; category++)
+		hash = (hash ^ (uint8_t) *category) * 0x100000001b3ULL;
+	hash = (hash ^ '\t') * 0x100000001b3ULL;
+	for (; *name != '\0'; name++)
+		hash = (hash ^ (uint8_t) *name) * 0x100000001b3ULL;
+	return (size_t) hash;
+}
+
+static cst_impact_test *find_test(const char *category, const char *name)
+{
+	if (g_buckets == NULL)
+		return NULL;
+	for (cst_impact_test *test = g_buckets[key_hash(category, name) & g_bucket_mask]; test != NULL; test = test->chain)
+		if (strcmp(test->category, category) == 0 && strcmp(test->name, name) == 0)
+			return test;
+	return NULL;
+}
+
+static cst_impact_test *add_test(const char *category, size_t category_len, const char *name, size_t name_len)
+{
+	cst_impact_test *test = calloc(1, sizeof(cst_impact_test));
+	size_t bucket;
+
+	if (test == NULL || (test->category = strndup(category, category_len)) == NULL
+		|| (test->name = strndup(name, name_len)) == NULL || (test->file = strdup("")) == NULL) {
+		if (test != NULL) {
+			free(test->category);
+			free(test->name);
+		}
+		free(test);
+		return NULL;
+	}
+	bucket = key_hash(test->category, test->name) & g_bucket_mask;
+	test->chain = g_buckets[bucket];
+	g_buckets[bucket] = test;
+	if (g_last == NULL)
+		g_first = test;
+	else
+		g_last->next = test;
+	g_last = test;
+	return test;
+}
+
+/* `file` ends with `suffix`, on a path component boundary */
+static bool path_matches(const char *file, size_t file_len, const char *suffix)
+{
+	size_t len = strlen(suffix);
+
+	if (len == 0 || len > file_len || memcmp(file + file_len - len, suffix, len) != 0)
+		return false;
+	return len == file_len || file[file_len - len - 1] == '/';
+}
+
+/* Either path ends with the other, __FILE__ is relative to where the test was built */
+static bool same_file(const char *file, const char *changed)
+{
+	size_t file_len = strlen(file);
+
+	return path_matches(file, file_len, changed) || path_matches(changed, strlen(changed), file);
+}
+
+/* A "\t<function>\t<file>" line matches a change to either */
+static bool line_impacted(const char *line, size_t len)
+{
+	const char *func = line + 1;
+	const char *tab = memchr(func, '\t', len - 1);
+	size_t func_len = tab != NULL ? (size_t) (tab - func) : len - 1;
+	const char *file = tab != NULL ? tab + 1 : line + len;
+	size_t file_len = (size_t) (line + len - file);
+
+	if (func_len == 1 && *func == '*')
+		return true;
+	for (size_t i = 0; i < g_changed_count; i++) {
+		if (strlen(g_changed[i]) == func_len && memcmp(g_changed[i], func, func_len) == 0)
+			return true;
+		if (path_matches(file, file_len, g_changed[i]))
+			return true;
+	}
+	return false;
+}
+
+static char *read_file(const char *path)
+{
+	FILE *in = fopen(path, "r");
+	char *buf = NULL;
+	size_t len = 0;
+	size_t size = 0;
+	size_t n;
+
+	if (in == NULL)
+		return NULL;
+	do {
+		if (len + 4096 + 1 > size) {
+			char *grown = realloc(buf, size = (size + 4096) * 2);
+			if (grown == NULL) {
+				free(buf);
+				fclose(in);
+				return NULL;
+			}
+			buf = grown;
+		}
+		n = fread(buf + len, 1, size - len - 1, in);
+		len += n;
+	} while (n > 0);
+	fclose(in);
+	buf[len] = '\0';
+	return buf;
+}
+
+/* "<category>\t<name>\t<file>", indexes from before files were recorded have no file */
+static cst_impact_test *load_test(const char *entry, size_t len)
+{
+	const char *name = memchr(entry, '\t', len);
+	const char *file;
+	cst_impact_test *test;
+	char *copy;
+
+	if (name == NULL)
+		return NULL;
+	name++;
+	file = memchr(name, '\t', (size_t) (entry + len - name));
+	test = add_test(entry, (size_t) (name - 1 - entry), name, (size_t) ((file != NULL ? file : entry + len) - name));
+	if (test != NULL && file != NULL && (copy = strndup(file + 1, (size_t) (entry + len - file - 1))) != NULL) {
+		free(test->file);
+		test->file = copy;
+	}
+	return test;
+}
+
+static void load_index(void)
+{
+	cst_impact_test *test = NULL;
+	char *line = g_index = read_file(g_path);
+
+	if (g_index == NULL)
+		return;
+	g_indexed = true;
+	while (*line != '\0') {
+		char *end = strchr(line, '\n');
+		size_t len = end != NULL ? (size_t) (end - line) : strlen(line);
+		if (strncmp(line, "test\t", 5) == 0) {
+			test = load_test(line + 5, len - 5);
+			if (test != NULL)
+				test->lines = end != NULL ? end + 1 : line + len;
+		} else if (line[0] == '\t' && test != NULL) {
+			test->lines_len = (size_t) (line + len - test->lines) + (end != NULL);
+			test->impacted = test->impacted || line_impacted(line, len);
+		}
+		line += len + (end != NULL);
+	}
+}
+
+/* Splits the -changed list on commas and blanks, or reads it from the file given as @<file> */
+static void parse_changed(const char *list)
+{
+	char *items = list[0] == '@' ? read_file(list + 1) : strdup(list);
+	char *save = NULL;
+
+	if (items == NULL) {
+		fprintf(stderr, CST_BRED"❌ Could not read changes from %s"CST_RES"\n", list + 1);
+		return;
+	}
+	for (char *item = strtok_r(items, ", \t\r\n", &save); item != NULL; item = strtok_r(NULL, ", \t\r\n", &save)) {
+		char **grown = realloc(g_changed, (g_changed_count + 1) * sizeof(char *));
+		if (grown == NULL)
+			break;
+		g_changed = grown;
+		g_changed[g_changed_count++] = item;
+	}
+}
+
+/*
+ - Internal API: Called by cst.c
+ */
+
+/* `tests` is the number of registered tests, to size the index */
+void cst_impact_init(const char *path, bool record, const char *changed, size_t tests)
+{
+	size_t buckets = 1024;
+
+	if (!record && changed == NULL)
+		return;
+	if (path != NULL)
+		g_path = path;
+	g_record = record;
+	if (record) {
+		g_shared = mmap(NULL, sizeof(cst_impact_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		g_syms = calloc(CST_IMPACT_SYMS, sizeof(cst_impact_sym));
+		if (g_shared == MAP_FAILED || g_syms == NULL) {
+			fprintf(stderr, CST_BRED"❌ Could not record test impact"CST_RES"\n");
+			g_shared = g_shared == MAP_FAILED ? NULL : g_shared;
+			g_record = false;
+		}
+	}
+	while (buckets < tests * 2)
+		buckets *= 2;
+	if ((g_buckets = calloc(buckets, sizeof(cst_impact_test *))) == NULL)
+		return;
+	g_bucket_mask = buckets - 1;
+	if (changed != NULL)
+		parse_changed(changed);
+	load_index();
+	if (changed == NULL)
+		return;
+	if (!g_indexed)
+		printf(CST_GRAY"🎯 "CST_YELLOW"No impact index at %s, every test runs"CST_RES"\n", g_path);
+	else
+		printf(CST_GRAY"🎯 "CST_BLUE"Running the tests impacted by %zu change(s), from %s"CST_RES"\n",
+			g_changed_count, g_path);
+}
+
+/* Tests defined in a changed file, and those the index doesn't know yet or has nothing for, always run */
+bool cst_impact_selected(const char *category, const char *name, const char *file)
+{
+	cst_impact_test *test;
+
+	if (g_changed == NULL || !g_indexed)
+		return true;
+	for (size_t i = 0; i < g_changed_count; i++)
+		if (same_file(file, g_changed[i]))
+			return true;
+	test = find_test(category, name);
+	return test == NULL || test->impacted || test->lines_len == 0;
+}
+
+/* Called by the runner before the test's first child */
+void cst_impact_test_begin(void)
+{
+	if (g_shared == NULL)
+		return;
+	if (g_shared->overflow)
+		memset(g_shared->slots, 0, sizeof(g_shared->slots));
+	else
+		for (size_t i = 0; i < g_shared->count; i++)
+			g_shared->slots[g_shared->used[i]] = 0;
+	g_shared->count = 0;
+	g_shared->overflow = false;
+}
+
+/*
+ - Helper: Symbolization, each address once for the whole run
+ */
+
+/* "\t<function>\t<file>\n", or NULL for addresses that don't resolve */
+static char *format_line(uintptr_t pc)
+{
+	char buf[1024];
+	char *at;
+	char *colon;
+
+	if (!cst_bt_resolve((void *) pc, buf, sizeof(buf)) || (at = strstr(buf, " at ")) == NULL)
+		return NULL;
+	*at = '\0';
+	if ((colon = strrchr(at + 4, ':')) != NULL)
+		*colon = '\0';
+	size_t len = strlen(buf) + strlen(at + 4) + 4;
+	char *line = malloc(len);
+	if (line != NULL)
+		snprintf(line, len, "\t%s\t%s\n", buf, at + 4);
+	return line;
+}
+
+/* `*owned` is set when the line isn't kept by the cache and must be freed */
+static char *resolve_line(uintptr_t pc, bool *owned)
+{
+	size_t i = pc_slot(pc) & (CST_IMPACT_SYMS - 1);
+	char *line;
+
+	*owned = false;
+	while (g_syms[i].pc != 0 && g_syms[i].pc != pc)
+		i = (i + 1) & (CST_IMPACT_SYMS - 1);
+	if (g_syms[i].pc == pc)
+		return g_syms[i].line;
+	line = format_line(pc);
+	// Half full at most, so probing stays short
+	if (g_syms_used >= CST_IMPACT_SYMS / 2) {
+		*owned = line != NULL;
+		return line;
+	}
+	g_syms[i].pc = pc;
+	g_syms[i].line = line;
+	g_syms_used++;
+	return line;
+}
+
+typedef struct cst_impact_line {
+	char *text;
+	bool owned;  // Not kept by the cache, freed once written
+} cst_impact_line;
+
+static int compare_lines(const void *a, const void *b)
+{
+	return strcmp(((const cst_impact_line *) a)->text, ((const cst_impact_line *) b)->text);
+}
+
+/* Resolved lines of the test, sorted and without duplicates */
+static char *collect_lines(void)
+{
+	size_t count = g_shared->count < CST_IMPACT_MAX ? g_shared->count : CST_IMPACT_MAX;
+	cst_impact_line *lines;
+	char *text;
+	size_t len = 0;
+	size_t n = 0;
+
+	if (g_shared->overflow || (lines = malloc((count + 1) * sizeof(cst_impact_line))) == NULL)
+		return strdup("\t*\t*\n");
+	for (size_t i = 0; i < count; i++) {
+		lines[n].text = resolve_line(g_shared->slots[g_shared->used[i]], &lines[n].owned);
+		n += lines[n].text != NULL;
+	}
+	qsort(lines, n, sizeof(cst_impact_line), compare_lines);
+	for (size_t i = 0; i < n; i++)
+		len += strlen(lines[i].text);
+	if ((text = malloc(len + 1)) != NULL) {
+		len = 0;
+		for (size_t i = 0; i < n; i++) {
+			size_t line_len = strlen(lines[i].text);
+			if (i > 0 && strcmp(lines[i].text, lines[i - 1].text) == 0)
+				continue;
+			memcpy(text + len, lines[i].text, line_len);
+			len += line_len;
+		}
+		text[len] = '\0';
+	}
+	for (size_t i = 0; i < n; i++)
+		if (lines[i].owned)
+			free(lines[i].text);
+	free(lines);
+	return text;
+}
+
+/* Called by the runner once the test's last child is reaped */
+void cst_impact_test_done(const char *category, const char *name, const char *file)
+{
+	cst_impact_test *test;
+	char *copy;
+
+	if (!g_record || g_shared == NULL)
+		return;
+	test = find_test(category, name);
+	if (test == NULL)
+		test = add_test(category, strlen(category), name, strlen(name));
+	if (test == NULL)
+		return;
+	if ((copy = strdup(file)) != NULL) {
+		free(test->file);
+		test->file = copy;
+	}
+	free(test->recorded);
+	test->recorded = collect_lines();
+}
+
+/* Called by the runner at the end of the run */
+void cst_impact_finish(void)
+{
+	char tmp[CST_PATH_MAX + 8];
+	size_t recorded = 0;
+	FILE *out;
+
+	if (!g_record) {
+		free(g_index);
+		return;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.%d", g_path, (int) getpid());
+	if ((out = fopen(tmp, "w")) == NULL) {
+		fprintf(stderr, CST_BRED"❌ Could not write test impact to %s"CST_RES"\n", g_path);
+		return;
+	}
+	for (cst_impact_test *test = g_first; test != NULL; test = test->next) {
+		if (test->recorded == NULL && test->lines == NULL)
+			continue;
+		fprintf(out, "test\t%s\t%s\t%s\n", test->category, test->name, test->file);
+		if (test->recorded != NULL) {
+			fputs(test->recorded, out);
+			recorded++;
+		} else
+			fwrite(test->lines, 1, test->lines_len, out);
+	}
+	if (fclose(out) != 0 || rename(tmp, g_path) == -1) {
+		unlink(tmp);
+		fprintf(stderr, CST_BRED"❌ Could not write test impact to %s"CST_RES"\n", g_path);
+		return;
+	}
+	printf(CST_GRAY"🎯 "CST_BLUE"Impact of %zu test(s) written to %s"CST_RES"\n", recorded, g_path);
+}
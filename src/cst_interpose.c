@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // These are the real symbols, not the macros
+#include "cst.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <link.h>
+#include <sys/auxv.h>
+
+/*
+ - Allocator interposition (-memall)
+ -
+ - libcst defines the standard allocation functions itself, so every
+ - allocation of the process goes through here, including the ones made
+ - by code that wasn't compiled with cst.h and by other libraries.
+ - Unless enabled for the current test, they just forward to glibc.
+ */
+
+void	*__libc_malloc(size_t size);
+void	*__libc_calloc(size_t nmemb, size_t size);
+void	*__libc_realloc(void *ptr, size_t size);
+void	*__libc_memalign(size_t alignment, size_t size);
+void	__libc_free(void *ptr);
+
+/*
+ - From cst_memcheck.c
+ */
+
+extern bool			cst_interpose_active;
+extern __thread int	cst_memcheck_depth;
+
+void	*cst_mem_alloc(size_t size, const char *file, int line, void *caller);
+void	*cst_mem_calloc(size_t nmemb, size_t size, const char *file, int line, void *caller);
+void	*cst_mem_memalign(size_t alignment, size_t size, const char *file, int line, void *caller);
+void	*cst_mem_realloc(void *ptr, size_t size, bool strict, const char *file, int line, void *caller);
+void	cst_mem_free(void *ptr, bool strict, const char *file, int line, void *caller);
+bool	cst_mem_free_guarded(void *ptr);
+bool	cst_mem_realloc_guarded(void *ptr, size_t size, void **res);
+
+/*
+ - The dynamic loader allocates per thread data (TLS) that glibc keeps
+ - cached along with thread stacks, those aren't leaks of the test.
+ */
+
+static uintptr_t	g_loader_start = 0;
+static uintptr_t	g_loader_end = 0;
+
+static int find_loader(struct dl_phdr_info *info, size_t size, void *data)
+{
+	(void) size;
+	if (info->dlpi_addr != *(uintptr_t *) data)
+		return 0;
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_LOAD)
+			continue;
+		uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+		uintptr_t end = start + phdr->p_memsz;
+		if (g_loader_start == 0 || start < g_loader_start)
+			g_loader_start = start;
+		if (end > g_loader_end)
+			g_loader_end = end;
+	}
+	return 1;
+}
+
+void cst_interpose_init(void)
+{
+	uintptr_t base = (uintptr_t) getauxval(AT_BASE);
+
+	if (base != 0)
+		dl_iterate_phdr(find_loader, &base);
+}
+
+/*
+ - Fast path: Not tracking, or called from within CST itself
+ */
+
+#define CST_INTERPOSING() \
+	(__builtin_expect(cst_interpose_active, 0) && cst_memcheck_depth == 0 \
+	&& ((uintptr_t) CST_CALLER - g_loader_start >= g_loader_end - g_loader_start))
+
+#define CST_CALLER __builtin_return_address(0)
+
+/* Guarded blocks can reach the fast path too, glibc can't free them as is */
+#define CST_GUARDED(ptr) (__builtin_expect(cst_memguard_enabled(), 0) && (ptr) != NULL)
+
+/*
+ - Helper: Tracked call with recursion guard
+ */
+
+#define CST_TRACKED(call) ({\
+	cst_memcheck_depth++;\
+	__typeof__(call) cst_res = (call);\
+	cst_memcheck_depth--;\
+	cst_res;\
+})
+
+void *malloc(size_t size)
+{
+	if (!CST_INTERPOSING())
+		return __libc_malloc(size);
+	return CST_TRACKED(cst_mem_alloc(size, NULL, 0, CST_CALLER));
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (!CST_INTERPOSING())
+		return __libc_calloc(nmemb, size);
+	return CST_TRACKED(cst_mem_calloc(nmemb, size, NULL, 0, CST_CALLER));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *res;
+
+	if (!CST_INTERPOSING()) {
+		if (CST_GUARDED(ptr) && cst_mem_realloc_guarded(ptr, size, &res))
+			return res;
+		return __libc_realloc(ptr, size);
+	}
+	return CST_TRACKED(cst_mem_realloc(ptr, size, false, NULL, 0, CST_CALLER));
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	size_t total;
+	void *res;
+
+	if (__builtin_mul_overflow(nmemb, size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (!CST_INTERPOSING()) {
+		if (CST_GUARDED(ptr) && cst_mem_realloc_guarded(ptr, total, &res))
+			return res;
+		return __libc_realloc(ptr, total);
+	}
+	return CST_TRACKED(cst_mem_realloc(ptr, total, false, NULL, 0, CST_CALLER));
+}
+
+void free(void *ptr)
+{
+	if (ptr == NULL || !CST_INTERPOSING()) {
+		if (!CST_GUARDED(ptr) || !cst_mem_free_guarded(ptr))
+			__libc_free(ptr);
+		return;
+	}
+	cst_memcheck_depth++;
+	cst_mem_free(ptr, false, NULL, 0, CST_CALLER);
+	cst_memcheck_depth--;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	if (!CST_INTERPOSING())
+		return __libc_memalign(alignment, size);
+	return CST_TRACKED(cst_mem_memalign(alignment, size, NULL, 0, CST_CALLER));
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	if (!CST_INTERPOSING())
+		return __libc_memalign(alignment, size);
+	return CST_TRACKED(cst_mem_memalign(alignment, size, NULL, 0, CST_CALLER));
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	if (!CST_INTERPOSING())
+		ptr = __libc_memalign(alignment, size);
+	else
+		ptr = CST_TRACKED(cst_mem_memalign(alignment, size, NULL, 0, CST_CALLER));
+	if (ptr == NULL)
+		return ENOMEM;
+	*memptr = ptr;
+	return 0;
+}
+
+void *valloc(size_t size)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+	if (!CST_INTERPOSING())
+		return __libc_memalign(page, size);
+	return CST_TRACKED(cst_mem_memalign(page, size, NULL, 0, CST_CALLER));
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+	size = (size + page - 1) & ~(page - 1);
+	if (!CST_INTERPOSING())
+		return __libc_memalign(page, size);
+	return CST_TRACKED(cst_mem_memalign(page, size, NULL, 0, CST_CALLER));
+}
+
+/*
+ - String duplication, so leaks point at the caller and not at libc
+ */
+
+char *strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *dup;
+
+	if (!CST_INTERPOSING())
+		dup = __libc_malloc(len);
+	else
+		dup = CST_TRACKED(cst_mem_alloc(len, NULL, 0, CST_CALLER));
+	if (dup != NULL)
+		memcpy(dup, s, len);
+	return dup;
+}
+
+char *strndup(const char *s, size_t n)
+{
+	size_t len = strnlen(s, n);
+	char *dup;
+
+	if (!CST_INTERPOSING())
+		dup = __libc_malloc(len + 1);
+	else
+		dup = CST_TRACKED(cst_mem_alloc(len + 1, NULL, 0, CST_CALLER));
+	if (dup != NULL) {
+		memcpy(dup, s, len);
+		dup[len] = '\0';
+	}
+	return dup;
+}
@@ -2,11 +2,68 @@
 #include "cst.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ - glibc's allocator, bypassing any interposition (See cst_interpose.c)
+ */
+
+void	*__libc_malloc(size_t size);
+void	*__libc_calloc(size_t nmemb, size_t size);
+void	*__libc_realloc(void *ptr, size_t size);
+void	*__libc_memalign(size_t alignment, size_t size);
+void	__libc_free(void *ptr);
+
+/*
+ - From cst_backtrace.c
+ */
+
+bool	cst_bt_resolve(void *addr, char *buf, size_t size);
+
+/*
+ - From cst_interpose.c
+ */
+
+void	cst_interpose_init(void);
+
+/*
+ - From cst_allocfail.c
+ */
+
+extern bool	cst_allocfail_enabled;
+
+bool	cst_allocfail_inject(const char *file, int line, void *caller);
+void	cst_allocfail_finish(void);
+
+/*
+ - From cst_stackdepot.c
+ */
+
+bool		cst_stackdepot_init(void);
+const void	*cst_stackdepot_capture(void *caller);
+int			cst_stackdepot_frames(const void *stack, void *const **frames);
+void		cst_stackdepot_lock(void);
+void		cst_stackdepot_unlock(void);
 
 /*
  - Allocation tracking structure
+ -
+ - Live allocations are kept in a table split in shards, each with its
+ - own spinlock, so threads allocating at the same time rarely contend.
+ - Tracking nodes and counters are per thread, and only merged when
+ - reading stats or checking leaks.
+ -
+ - Allocations are tagged with the epoch they were made in. The runner
+ - starts a new epoch right before each test, so whatever was allocated
+ - before (Hooks, the runner itself) isn't part of the test's leaks or
+ - stats, without having to copy or clear the table.
  */
 
 typedef struct cst_alloc {
@@ -14,142 +71,1112 @@ typedef struct cst_alloc {
 	size_t size;
 	const char *file;
 	int line;
+	int tid;
+	unsigned int epoch;
+	unsigned int offset;  // Left redzone size, 0 if unguarded
+	void *caller;
+	const void *stack;  // Allocation stack (-memstacks), from the depot
 	struct cst_alloc *next;
 } cst_alloc;
 
-static cst_alloc *g_allocs = NULL;
+/* Must be powers of two */
+#define CST_ALLOC_SHARDS 64
+#define CST_SHARD_BUCKETS 256
+
+/* Tracking nodes allocated at once when a thread runs out of them */
+#define CST_NODE_SLAB 64
+
+typedef struct cst_alloc_shard {
+	int lock;
+	size_t count;
+	unsigned int epoch;
+	size_t epoch_count;
+	cst_alloc *buckets[CST_SHARD_BUCKETS];
+} __attribute__((aligned(64))) cst_alloc_shard;
+
+typedef struct cst_mem_thread {
+	int tid;
+	size_t allocs;
+	size_t frees;
+	size_t bytes;
+	cst_alloc *free_nodes;
+	struct cst_mem_thread *next;
+} cst_mem_thread;
+
+static cst_alloc_shard g_shards[CST_ALLOC_SHARDS];
+static cst_mem_thread *g_threads = NULL;
+static __thread cst_mem_thread *t_self = NULL;
+static unsigned int g_epoch = 0;
+static size_t g_live_bytes = 0;
+static size_t g_peak_bytes = 0;
 static bool g_memcheck_enabled = true;
+static bool g_interpose_requested = false;
+static bool g_stacks_enabled = false;
+
+/*
+ - Heap hardening (-memguard)
+ -
+ - Guarded blocks are surrounded by canary filled redzones, which are
+ - checked when freeing them and when the test exits. Freed blocks are
+ - poisoned and kept in a bounded quarantine before being given back to
+ - glibc, so writes to them after free are caught once they leave it.
+ */
+
+#define CST_REDZONE 32
+#define CST_REDZONE_BYTE 0xFA
+#define CST_FREED_BYTE 0xFD
+
+/* Blocks larger than the byte budget skip the quarantine */
+#define CST_QUARANTINE_SLOTS 1024
+#define CST_QUARANTINE_BYTES (8 * 1024 * 1024)
+
+typedef struct cst_quarantined {
+	cst_alloc block;
+	const char *free_file;
+	int free_line;
+	void *free_caller;
+} cst_quarantined;
+
+static cst_quarantined *g_quarantine = NULL;
+static size_t g_quarantine_head = 0;
+static size_t g_quarantine_len = 0;
+static size_t g_quarantine_bytes = 0;
+static int g_quarantine_lock = 0;
+static bool g_guard_enabled = false;
+
+/*
+ - Allocation profiling (Per test, since each test is a fresh fork)
+ */
+
+typedef struct cst_alloc_site {
+	const char *file;
+	int line;
+	void *caller;
+	size_t count;
+	size_t bytes;
+} cst_alloc_site;
+
+/* Must be a power of two */
+#define CST_ALLOC_SITES 1024
+#define CST_ALLOC_SITES_SHOWN 10
+
+static cst_alloc_site *g_sites = NULL;
+static int g_sites_lock = 0;
+static bool g_stats_requested = false;
 
 /*
- - Helper: Add allocation to tracking list
+ - Shared with cst_interpose.c
  */
 
-static void track_alloc(void *ptr, size_t size, const char *file, int line)
+bool cst_interpose_active = false;
+__thread int cst_memcheck_depth = 0;
+
+/*
+ - Helper: Locking
+ */
+
+static inline void spin_lock(int *lock)
 {
-	if (!ptr || !g_memcheck_enabled)
-		return;
-	
-	cst_alloc *node = malloc(sizeof(cst_alloc));
-	if (!node) {
-		fprintf(stderr, CST_BRED"CST: Failed to allocate tracking node\n"CST_RES);
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+			sched_yield();
+}
+
+static inline void spin_unlock(int *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Counters have a single writer (Their thread), but may be read by any */
+#define CST_BUMP(field, n) __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+/*
+ - Helper: Pointer hashing, the top bits pick the shard
+ */
+
+static inline cst_alloc_shard *alloc_shard(const void *ptr, size_t *bucket)
+{
+	uint64_t hash = ((uint64_t) (uintptr_t) ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+
+	*bucket = (size_t) (hash >> 42) & (CST_SHARD_BUCKETS - 1);
+	return &g_shards[hash >> 58 & (CST_ALLOC_SHARDS - 1)];
+}
+
+/*
+ - Helper: Per thread data, registered on first use
+ */
+
+static cst_mem_thread *current_thread(void)
+{
+	cst_mem_thread *self = t_self;
+
+	if (__builtin_expect(self != NULL, 1))
+		return self;
+	self = __libc_calloc(1, sizeof(cst_mem_thread));
+	if (self == NULL) {
+		fprintf(stderr, CST_BRED"CST: Failed to allocate thread tracking data\n"CST_RES);
 		exit(EXIT_FAILURE);
 	}
-	
+	self->tid = (int) syscall(SYS_gettid);
+	self->next = __atomic_load_n(&g_threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&g_threads, &self->next, self, true,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	t_self = self;
+	return self;
+}
+
+static cst_alloc *node_get(cst_mem_thread *self)
+{
+	cst_alloc *node = self->free_nodes;
+
+	if (node == NULL) {
+		node = __libc_malloc(CST_NODE_SLAB * sizeof(cst_alloc));
+		if (!node) {
+			fprintf(stderr, CST_BRED"CST: Failed to allocate tracking node\n"CST_RES);
+			exit(EXIT_FAILURE);
+		}
+		for (size_t i = 1; i < CST_NODE_SLAB - 1; i++)
+			node[i].next = &node[i + 1];
+		node[CST_NODE_SLAB - 1].next = NULL;
+		node->next = &node[1];
+	}
+	self->free_nodes = node->next;
+	return node;
+}
+
+static inline void node_put(cst_mem_thread *self, cst_alloc *node)
+{
+	node->next = self->free_nodes;
+	self->free_nodes = node;
+}
+
+static void live_bytes_add(size_t size)
+{
+	size_t live = __atomic_add_fetch(&g_live_bytes, size, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&g_peak_bytes, __ATOMIC_RELAXED);
+
+	while (live > peak && !__atomic_compare_exchange_n(&g_peak_bytes, &peak, live, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ - Helper: Per call site histogram
+ */
+
+static void count_site(size_t size, const char *file, int line, void *caller)
+{
+	uintptr_t key = file != NULL ? (uintptr_t) file ^ ((uintptr_t) line << 3) : (uintptr_t) caller;
+	size_t i = (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 54) & (CST_ALLOC_SITES - 1);
+
+	spin_lock(&g_sites_lock);
+	for (size_t probes = 0; probes < CST_ALLOC_SITES; probes++) {
+		cst_alloc_site *site = &g_sites[i];
+		if (site->count == 0) {
+			site->file = file;
+			site->line = line;
+			site->caller = caller;
+		} else if (site->file != file || site->line != line || (file == NULL && site->caller != caller)) {
+			i = (i + 1) & (CST_ALLOC_SITES - 1);
+			continue;
+		}
+		site->count++;
+		site->bytes += size;
+		break;
+	}
+	spin_unlock(&g_sites_lock);
+}
+
+/*
+ - Helper: Add allocation to tracking table
+ */
+
+static void insert_node(cst_alloc *node)
+{
+	size_t bucket;
+	cst_alloc_shard *shard = alloc_shard(node->ptr, &bucket);
+
+	spin_lock(&shard->lock);
+	node->next = shard->buckets[bucket];
+	shard->buckets[bucket] = node;
+	shard->count++;
+	// Blocks restored from before the test don't count towards it
+	if (node->epoch == __atomic_load_n(&g_epoch, __ATOMIC_RELAXED)) {
+		if (shard->epoch != node->epoch) {
+			shard->epoch = node->epoch;
+			shard->epoch_count = 0;
+		}
+		__atomic_store_n(&shard->epoch_count, shard->epoch_count + 1, __ATOMIC_RELAXED);
+	}
+	spin_unlock(&shard->lock);
+}
+
+static void track_alloc(void *ptr, size_t size, unsigned int offset, const char *file, int line, void *caller)
+{
+	if (!ptr)
+		return;
+
+	cst_mem_thread *self = current_thread();
+	CST_BUMP(self->allocs, 1);
+	CST_BUMP(self->bytes, size);
+	if (g_sites != NULL)
+		count_site(size, file, line, caller);
+	if (!g_memcheck_enabled)
+		return;
+	live_bytes_add(size);
+
+	cst_alloc *node = node_get(self);
 	node->ptr = ptr;
 	node->size = size;
 	node->file = file;
 	node->line = line;
-	node->next = g_allocs;
-	g_allocs = node;
+	node->tid = self->tid;
+	node->epoch = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED);
+	node->offset = offset;
+	node->caller = caller;
+	node->stack = g_stacks_enabled ? cst_stackdepot_capture(caller) : NULL;
+	insert_node(node);
+}
+
+/* Tracks a block again as it was, when a failed realloc leaves it alive */
+static void restore_alloc(const cst_alloc *info)
+{
+	cst_alloc *node = node_get(current_thread());
+
+	if (info->epoch == __atomic_load_n(&g_epoch, __ATOMIC_RELAXED))
+		live_bytes_add(info->size);
+	*node = *info;
+	insert_node(node);
 }
 
 /*
- - Helper: Remove allocation from tracking list
+ - Helper: Remove allocation from tracking table, or only if it's guarded
  */
 
-static bool untrack_alloc(void *ptr, const char *file, int line)
+static bool untrack_alloc(void *ptr, cst_alloc *info, bool guarded_only)
 {
-	if (!ptr)
-		return true;
-	
-	if (!g_memcheck_enabled)
-		return true;
-	
-	cst_alloc **curr = &g_allocs;
-	while (*curr) {
+	cst_alloc *found = NULL;
+	size_t bucket;
+	cst_alloc_shard *shard = alloc_shard(ptr, &bucket);
+
+	spin_lock(&shard->lock);
+	for (cst_alloc **curr = &shard->buckets[bucket]; *curr; curr = &(*curr)->next) {
 		if ((*curr)->ptr == ptr) {
-			cst_alloc *tmp = *curr;
-			*curr = (*curr)->next;
-			free(tmp);
-			return true;
+			if (guarded_only && (*curr)->offset == 0)
+				break;
+			found = *curr;
+			*curr = found->next;
+			shard->count--;
+			if (found->epoch == shard->epoch)
+				__atomic_store_n(&shard->epoch_count, shard->epoch_count - 1, __ATOMIC_RELAXED);
+			break;
 		}
-		curr = &(*curr)->next;
 	}
-	
-	// Not found = double free or freeing untracked memory
-	fprintf(stderr, CST_BRED"💥 %s "CST_GRAY"-"CST_RED" Double free or invalid free at %s:%d"CST_RES"\n",
-			CST_TEST_NAME, file, line);
-	exit(EXIT_FAILURE);
-	return false;
+	spin_unlock(&shard->lock);
+	if (found == NULL)
+		return false;
+	if (found->epoch == __atomic_load_n(&g_epoch, __ATOMIC_RELAXED))
+		__atomic_sub_fetch(&g_live_bytes, found->size, __ATOMIC_RELAXED);
+	if (info != NULL)
+		*info = *found;
+	node_put(current_thread(), found);
+	return true;
 }
 
 /*
- - Public API: Tracked allocations
+ - Helper: Live allocations of the current epoch
  */
 
-void* cst_malloc_impl(size_t size, const char *file, int line)
+static size_t live_alloc_count(void)
 {
-	void *ptr = malloc(size);
-	if (ptr)
-		track_alloc(ptr, size, file, line);
-	return ptr;
+	unsigned int epoch = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED);
+	size_t total = 0;
+
+	for (size_t i = 0; i < CST_ALLOC_SHARDS; i++)
+		if (__atomic_load_n(&g_shards[i].epoch, __ATOMIC_RELAXED) == epoch)
+			total += __atomic_load_n(&g_shards[i].epoch_count, __ATOMIC_RELAXED);
+	return total;
 }
 
-void* cst_calloc_impl(size_t nmemb, size_t size, const char *file, int line)
+/*
+ - Helper: Copy of the live allocations of the current epoch, so they can be
+ - reported without holding any lock (Symbolization may fork, see
+ - cst_memcheck_atfork_*)
+ */
+
+static cst_alloc *snapshot_allocs(size_t *count)
+{
+	unsigned int epoch = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED);
+	size_t total = live_alloc_count();
+	size_t n = 0;
+	cst_alloc *snap;
+
+	snap = __libc_malloc((total + 1) * sizeof(cst_alloc));
+	if (snap == NULL) {
+		*count = 0;
+		return NULL;
+	}
+	for (size_t i = 0; i < CST_ALLOC_SHARDS; i++) {
+		cst_alloc_shard *shard = &g_shards[i];
+		spin_lock(&shard->lock);
+		for (size_t b = 0; b < CST_SHARD_BUCKETS && n < total; b++)
+			for (cst_alloc *a = shard->buckets[b]; a && n < total; a = a->next)
+				if (a->epoch == epoch)
+					snap[n++] = *a;
+		spin_unlock(&shard->lock);
+	}
+	*count = n;
+	return snap;
+}
+
+/*
+ - Helper: Describe where an allocation or free happened
+ */
+
+static void describe_site(char *buf, size_t size, const char *file, int line, void *caller)
+{
+	if (file != NULL)
+		snprintf(buf, size, "at %s:%d", file, line);
+	else if (size > 3 && cst_bt_resolve(caller, buf + 3, size - 3))
+		memcpy(buf, "in ", 3);
+	else
+		snprintf(buf, size, "at %p", caller);
+}
+
+static void report_invalid_free(const char *file, int line, void *caller)
+{
+	char where[CST_PATH_MAX];
+
+	cst_memcheck_depth++;
+	describe_site(where, sizeof(where), file, line, caller);
+	fprintf(stderr, CST_BRED"💥 %s "CST_GRAY"-"CST_RED" Double free or invalid free %s"CST_RES"\n",
+			CST_TEST_NAME, where);
+	exit(CST_EXIT_MEMERROR);
+}
+
+/*
+ - Helper: Redzones and quarantine (-memguard)
+ */
+
+static void *guard_alloc(size_t size, size_t alignment, bool zero, unsigned int *offset)
+{
+	size_t left = alignment > CST_REDZONE ? alignment : CST_REDZONE;
+	size_t total;
+	unsigned char *raw;
+
+	if (__builtin_add_overflow(size, left + CST_REDZONE, &total))
+		return NULL;
+	raw = alignment > 16 ? __libc_memalign(alignment, total) : __libc_malloc(total);
+	if (raw == NULL)
+		return NULL;
+	memset(raw, CST_REDZONE_BYTE, left);
+	if (zero)
+		memset(raw + left, 0, size);
+	memset(raw + left + size, CST_REDZONE_BYTE, CST_REDZONE);
+	*offset = (unsigned int) left;
+	return raw + left;
+}
+
+/* Returns the offset of the first byte that isn't `byte`, or `len` */
+static size_t find_not(const unsigned char *mem, unsigned char byte, size_t len)
+{
+	uint64_t word = 0x0101010101010101ULL * byte;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t chunk;
+		memcpy(&chunk, mem + i, 8);
+		if (chunk != word)
+			break;
+	}
+	for (; i < len; i++)
+		if (mem[i] != byte)
+			return i;
+	return len;
+}
+
+static void report_corruption(const cst_alloc *block, const char *what, long offset,
+	const char *free_file, int free_line, void *free_caller, const char *extra)
+{
+	char where[CST_PATH_MAX];
+
+	cst_memcheck_depth++;
+	cst_interpose_active = false;
+	describe_site(where, sizeof(where), block->file, block->line, block->caller);
+	if (offset < 0)
+		fprintf(stderr, CST_BRED"💥 %s "CST_GRAY"-"CST_RED" %s of a %zu byte block allocated %s"CST_RES"\n",
+				CST_TEST_NAME, what, block->size, where);
+	else
+		fprintf(stderr, CST_BRED"💥 %s "CST_GRAY"-"CST_RED" %s at offset %ld of a %zu byte block allocated %s"CST_RES"\n",
+				CST_TEST_NAME, what, offset, block->size, where);
+	if (free_file != NULL || free_caller != NULL) {
+		describe_site(where, sizeof(where), free_file, free_line, free_caller);
+		fprintf(stderr, CST_GRAY"  - "CST_RED"%s %s"CST_RES"\n", extra, where);
+	}
+	exit(CST_EXIT_MEMERROR);
+}
+
+static void guard_check_redzones(const cst_alloc *block, const char *file, int line, void *caller)
+{
+	const unsigned char *user = block->ptr;
+	size_t bad;
+
+	bad = find_not(user - block->offset, CST_REDZONE_BYTE, block->offset);
+	if (bad != block->offset)
+		report_corruption(block, "Heap buffer underflow", (long) bad - (long) block->offset,
+			file, line, caller, "Detected when freeing it");
+	bad = find_not(user + block->size, CST_REDZONE_BYTE, CST_REDZONE);
+	if (bad != CST_REDZONE)
+		report_corruption(block, "Heap buffer overflow", (long) (block->size + bad),
+			file, line, caller, "Detected when freeing it");
+}
+
+static void guard_check_quarantined(const cst_quarantined *q)
+{
+	size_t bad = find_not(q->block.ptr, CST_FREED_BYTE, q->block.size);
+
+	if (bad != q->block.size)
+		report_corruption(&q->block, "Heap use after free (write)", (long) bad,
+			q->free_file, q->free_line, q->free_caller, "Freed");
+}
+
+static void guard_release(const cst_alloc *block, const char *file, int line, void *caller)
+{
+	unsigned char *raw = (unsigned char *) block->ptr - block->offset;
+	cst_quarantined evicted[2];
+	size_t n_evicted = 0;
+
+	guard_check_redzones(block, file, line, caller);
+	if (g_quarantine == NULL || block->size > CST_QUARANTINE_BYTES / 4) {
+		__libc_free(raw);
+		return;
+	}
+	memset(block->ptr, CST_FREED_BYTE, block->size);
+	spin_lock(&g_quarantine_lock);
+	// Make room, oldest blocks leave first
+	while (g_quarantine_len == CST_QUARANTINE_SLOTS
+		|| g_quarantine_bytes + block->size > CST_QUARANTINE_BYTES) {
+		cst_quarantined *old = &g_quarantine[g_quarantine_head];
+		g_quarantine_head = (g_quarantine_head + 1) % CST_QUARANTINE_SLOTS;
+		g_quarantine_len--;
+		g_quarantine_bytes -= old->block.size;
+		if (n_evicted == 2) {
+			// Don't hold the lock for long, check extra evictions right away
+			spin_unlock(&g_quarantine_lock);
+			for (size_t i = 0; i < n_evicted; i++) {
+				guard_check_quarantined(&evicted[i]);
+				__libc_free((unsigned char *) evicted[i].block.ptr - evicted[i].block.offset);
+			}
+			n_evicted = 0;
+			spin_lock(&g_quarantine_lock);
+		}
+		evicted[n_evicted++] = *old;
+	}
+	cst_quarantined *slot = &g_quarantine[(g_quarantine_head + g_quarantine_len) % CST_QUARANTINE_SLOTS];
+	slot->block = *block;
+	slot->free_file = file;
+	slot->free_line = line;
+	slot->free_caller = caller;
+	g_quarantine_len++;
+	g_quarantine_bytes += block->size;
+	spin_unlock(&g_quarantine_lock);
+	for (size_t i = 0; i < n_evicted; i++) {
+		guard_check_quarantined(&evicted[i]);
+		__libc_free((unsigned char *) evicted[i].block.ptr - evicted[i].block.offset);
+	}
+}
+
+static bool guard_is_quarantined(const void *ptr, cst_quarantined *found)
+{
+	bool res = false;
+
+	if (g_quarantine == NULL)
+		return false;
+	spin_lock(&g_quarantine_lock);
+	for (size_t i = 0; i < g_quarantine_len && !res; i++) {
+		cst_quarantined *q = &g_quarantine[(g_quarantine_head + i) % CST_QUARANTINE_SLOTS];
+		if (q->block.ptr == ptr) {
+			*found = *q;
+			res = true;
+		}
+	}
+	spin_unlock(&g_quarantine_lock);
+	return res;
+}
+
+/* Verifies every guarded block, live or quarantined, when the test exits */
+static void guard_check_all(void)
 {
-	void *ptr = calloc(nmemb, size);
+	size_t count = 0;
+	cst_alloc *bad = NULL;
+
+	for (size_t i = 0; i < CST_ALLOC_SHARDS && bad == NULL; i++) {
+		cst_alloc_shard *shard = &g_shards[i];
+		spin_lock(&shard->lock);
+		for (size_t b = 0; b < CST_SHARD_BUCKETS && bad == NULL; b++) {
+			for (cst_alloc *a = shard->buckets[b]; a && bad == NULL; a = a->next) {
+				const unsigned char *user = a->ptr;
+				if (a->offset == 0)
+					continue;
+				if (find_not(user - a->offset, CST_REDZONE_BYTE, a->offset) != a->offset
+					|| find_not(user + a->size, CST_REDZONE_BYTE, CST_REDZONE) != CST_REDZONE)
+					bad = a;
+			}
+		}
+		spin_unlock(&shard->lock);
+	}
+	if (bad != NULL) {
+		cst_alloc copy = *bad;
+		guard_check_redzones(&copy, NULL, 0, NULL);
+	}
+	if (g_quarantine == NULL)
+		return;
+	spin_lock(&g_quarantine_lock);
+	count = g_quarantine_len;
+	spin_unlock(&g_quarantine_lock);
+	for (size_t i = 0; i < count; i++)
+		guard_check_quarantined(&g_quarantine[(g_quarantine_head + i) % CST_QUARANTINE_SLOTS]);
+}
+
+/*
+ - Internal API: Shared by the macros and the interposed allocator.
+ - When `strict` is false, freeing untracked memory is allowed, as it may
+ - come from before tracking started (Or from outside of CST's reach).
+ */
+
+static void *tracked_alloc(size_t size, size_t alignment, bool zero, const char *file, int line, void *caller)
+{
+	unsigned int offset = 0;
+	void *ptr;
+
+	if (__builtin_expect(cst_allocfail_enabled, 0) && cst_allocfail_inject(file, line, caller)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (g_guard_enabled)
+		ptr = guard_alloc(size, alignment, zero, &offset);
+	else if (alignment > 16)
+		ptr = __libc_memalign(alignment, size);
+	else
+		ptr = zero ? __libc_calloc(1, size) : __libc_malloc(size);
 	if (ptr)
-		track_alloc(ptr, nmemb * size, file, line);
+		track_alloc(ptr, size, offset, file, line, caller);
 	return ptr;
 }
 
-void* cst_realloc_impl(void *ptr, size_t size, const char *file, int line)
+void *cst_mem_alloc(size_t size, const char *file, int line, void *caller)
 {
-	if (ptr)
-		untrack_alloc(ptr, file, line);
-	
-	void *new_ptr = realloc(ptr, size);
+	return tracked_alloc(size, 16, false, file, line, caller);
+}
+
+void *cst_mem_calloc(size_t nmemb, size_t size, const char *file, int line, void *caller)
+{
+	size_t total;
+
+	if (__builtin_mul_overflow(nmemb, size, &total))
+		return NULL;
+	return tracked_alloc(total, 16, true, file, line, caller);
+}
+
+void *cst_mem_memalign(size_t alignment, size_t size, const char *file, int line, void *caller)
+{
+	return tracked_alloc(size, alignment, false, file, line, caller);
+}
+
+static void check_untracked_free(void *ptr, bool strict, const char *file, int line, void *caller)
+{
+	cst_quarantined q;
+
+	if (g_guard_enabled && guard_is_quarantined(ptr, &q))
+		report_corruption(&q.block, "Double free", -1, q.free_file, q.free_line, q.free_caller,
+			"Already freed");
+	if (strict)
+		report_invalid_free(file, line, caller);
+}
+
+void *cst_mem_realloc(void *ptr, size_t size, bool strict, const char *file, int line, void *caller)
+{
+	cst_alloc info = {0};
+	bool tracked = false;
+
+	if (size > 0 && __builtin_expect(cst_allocfail_enabled, 0) && cst_allocfail_inject(file, line, caller)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (ptr && g_memcheck_enabled && !(tracked = untrack_alloc(ptr, &info, false)))
+		check_untracked_free(ptr, strict, file, line, caller);
+
+	if (info.offset != 0) {
+		if (size == 0) {
+			CST_BUMP(current_thread()->frees, 1);
+			guard_release(&info, file, line, caller);
+			return NULL;
+		}
+		void *new_ptr = cst_mem_alloc(size, file, line, caller);
+		if (new_ptr == NULL) {
+			restore_alloc(&info);
+			return NULL;
+		}
+		memcpy(new_ptr, ptr, info.size < size ? info.size : size);
+		CST_BUMP(current_thread()->frees, 1);
+		guard_release(&info, file, line, caller);
+		return new_ptr;
+	}
+
+	void *new_ptr = __libc_realloc(ptr, size);
+	// The old block is released unless growing it failed, even if it's reused in place
+	if (ptr && (new_ptr || size == 0))
+		CST_BUMP(current_thread()->frees, 1);
 	if (new_ptr && size > 0)
-		track_alloc(new_ptr, size, file, line);
-	
+		track_alloc(new_ptr, size, 0, file, line, caller);
+	else if (!new_ptr && tracked && size > 0)
+		restore_alloc(&info);  // Original block is still alive
 	return new_ptr;
 }
 
-void cst_free_impl(void *ptr, const char *file, int line)
+void cst_mem_free(void *ptr, bool strict, const char *file, int line, void *caller)
 {
+	cst_alloc info;
+
 	if (!ptr)
 		return;
-	
-	untrack_alloc(ptr, file, line);
-	free(ptr);
+	CST_BUMP(current_thread()->frees, 1);
+	if (!g_memcheck_enabled) {
+		__libc_free(ptr);
+		return;
+	}
+	if (!untrack_alloc(ptr, &info, false))
+		check_untracked_free(ptr, strict, file, line, caller);
+	else if (info.offset != 0) {
+		guard_release(&info, file, line, caller);
+		return;
+	}
+	__libc_free(ptr);
+}
+
+/*
+ - Internal API: Guarded blocks reaching the untracked fast path of the
+ - interposed allocator, from CST itself or from atexit handlers once the
+ - test is over. glibc only knows their raw pointer, the block they're
+ - moved to by realloc is a plain untracked one.
+ */
+
+bool cst_mem_free_guarded(void *ptr)
+{
+	cst_alloc info;
+
+	if (!untrack_alloc(ptr, &info, true))
+		return false;
+	guard_release(&info, NULL, 0, NULL);
+	return true;
+}
+
+bool cst_mem_realloc_guarded(void *ptr, size_t size, void **res)
+{
+	cst_alloc info;
+
+	if (!untrack_alloc(ptr, &info, true))
+		return false;
+	*res = size > 0 ? __libc_malloc(size) : NULL;
+	if (*res == NULL && size > 0) {
+		restore_alloc(&info);
+		return true;
+	}
+	if (*res != NULL)
+		memcpy(*res, ptr, info.size < size ? info.size : size);
+	guard_release(&info, NULL, 0, NULL);
+	return true;
+}
+
+/*
+ - Internal API: Setup, called by cst.c
+ */
+
+void cst_memcheck_init(bool enabled, bool interpose, bool stats, bool guard, bool stacks)
+{
+	g_memcheck_enabled = enabled;
+	g_interpose_requested = enabled && interpose;
+	g_stacks_enabled = enabled && stacks && cst_stackdepot_init();
+	g_stats_requested = stats;
+	g_guard_enabled = enabled && guard;
+	if (g_guard_enabled)
+		g_quarantine = __libc_malloc(CST_QUARANTINE_SLOTS * sizeof(cst_quarantined));
+	if (g_interpose_requested)
+		cst_interpose_init();
+}
+
+void cst_memcheck_test_start(void)
+{
+	// New epoch: Counters restart and inherited memory is no longer the test's
+	__atomic_add_fetch(&g_epoch, 1, __ATOMIC_RELAXED);
+	for (cst_mem_thread *t = g_threads; t != NULL; t = t->next) {
+		t->allocs = 0;
+		t->frees = 0;
+		t->bytes = 0;
+	}
+	g_live_bytes = 0;
+	g_peak_bytes = 0;
+	if (g_stats_requested && g_sites == NULL)
+		g_sites = __libc_calloc(CST_ALLOC_SITES, sizeof(cst_alloc_site));
+	cst_interpose_active = g_interpose_requested;
+}
+
+/*
+ - Fork safety: No thread may hold a shard while the process is copied
+ */
+
+static void cst_memcheck_atfork_prepare(void)
+{
+	spin_lock(&g_sites_lock);
+	spin_lock(&g_quarantine_lock);
+	for (size_t i = 0; i < CST_ALLOC_SHARDS; i++)
+		spin_lock(&g_shards[i].lock);
+	cst_stackdepot_lock();
+}
+
+static void cst_memcheck_atfork_parent(void)
+{
+	cst_stackdepot_unlock();
+	for (size_t i = 0; i < CST_ALLOC_SHARDS; i++)
+		spin_unlock(&g_shards[i].lock);
+	spin_unlock(&g_quarantine_lock);
+	spin_unlock(&g_sites_lock);
+}
+
+static void cst_memcheck_atfork_child(void)
+{
+	cst_memcheck_atfork_parent();
+	if (t_self != NULL)
+		t_self->tid = (int) syscall(SYS_gettid);
+}
+
+__attribute__((constructor))
+static void cst_memcheck_setup_fork(void)
+{
+	pthread_atfork(cst_memcheck_atfork_prepare, cst_memcheck_atfork_parent, cst_memcheck_atfork_child);
+}
+
+/*
+ - Allocation statistics report (-memstats)
+ */
+
+static int compare_sites(const void *a, const void *b)
+{
+	const cst_alloc_site *sa = a;
+	const cst_alloc_site *sb = b;
+
+	if (sa->count != sb->count)
+		return sa->count < sb->count ? 1 : -1;
+	return sa->bytes < sb->bytes ? 1 : (sa->bytes > sb->bytes ? -1 : 0);
+}
+
+static void print_alloc_stats(void)
+{
+	char where[CST_PATH_MAX];
+	size_t used = 0;
+	cst_alloc_stats stats = cst_get_alloc_stats();
+
+	if (stats.allocs == 0)
+		return;
+	cst_memcheck_depth++;
+	fprintf(stderr, CST_GRAY"  📊 "CST_BLUE"%zu allocation(s)"CST_GRAY", "CST_BLUE"%zu free(s)"CST_GRAY", "
+			CST_BLUE"%zu bytes allocated"CST_GRAY", "CST_BLUE"%zu bytes peak"CST_RES"\n",
+			stats.allocs, stats.frees, stats.bytes, stats.peak_bytes);
+	for (size_t i = 0; i < CST_ALLOC_SITES; i++)
+		if (g_sites[i].count != 0)
+			g_sites[used++] = g_sites[i];
+	qsort(g_sites, used, sizeof(cst_alloc_site), compare_sites);
+	for (size_t i = 0; i < used && i < CST_ALLOC_SITES_SHOWN; i++) {
+		describe_site(where, sizeof(where), g_sites[i].file, g_sites[i].line, g_sites[i].caller);
+		fprintf(stderr, CST_GRAY"    - "CST_BLUE"%zux "CST_GRAY"("CST_BLUE"%zu bytes"CST_GRAY") "CST_BLUE"%s"CST_RES"\n",
+				g_sites[i].count, g_sites[i].bytes, where);
+	}
+	if (used > CST_ALLOC_SITES_SHOWN)
+		fprintf(stderr, CST_GRAY"    ... and %zu more site(s)"CST_RES"\n", used - CST_ALLOC_SITES_SHOWN);
+	cst_memcheck_depth--;
+}
+
+/*
+ - Public API: Tracked allocations
+ - The caller is only used to find where allocation stacks start.
+ */
+
+void* cst_malloc_impl(size_t size, const char *file, int line)
+{
+	return cst_mem_alloc(size, file, line, __builtin_return_address(0));
+}
+
+void* cst_calloc_impl(size_t nmemb, size_t size, const char *file, int line)
+{
+	return cst_mem_calloc(nmemb, size, file, line, __builtin_return_address(0));
+}
+
+void* cst_realloc_impl(void *ptr, size_t size, const char *file, int line)
+{
+	return cst_mem_realloc(ptr, size, true, file, line, __builtin_return_address(0));
+}
+
+void cst_free_impl(void *ptr, const char *file, int line)
+{
+	cst_mem_free(ptr, true, file, line, __builtin_return_address(0));
+}
+
+/*
+ - Public API: Allocation profiling
+ */
+
+cst_alloc_stats cst_get_alloc_stats(void)
+{
+	cst_alloc_stats stats = {0};
+
+	for (cst_mem_thread *t = __atomic_load_n(&g_threads, __ATOMIC_ACQUIRE); t != NULL; t = t->next) {
+		stats.allocs += __atomic_load_n(&t->allocs, __ATOMIC_RELAXED);
+		stats.frees += __atomic_load_n(&t->frees, __ATOMIC_RELAXED);
+		stats.bytes += __atomic_load_n(&t->bytes, __ATOMIC_RELAXED);
+	}
+	stats.live_bytes = __atomic_load_n(&g_live_bytes, __ATOMIC_RELAXED);
+	stats.peak_bytes = __atomic_load_n(&g_peak_bytes, __ATOMIC_RELAXED);
+	return stats;
+}
+
+cst_alloc_scope cst_alloc_scope_begin(size_t max, const char *file, int line)
+{
+	cst_alloc_stats stats = cst_get_alloc_stats();
+	cst_alloc_scope scope = {
+		.allocs = stats.allocs,
+		.bytes = stats.bytes,
+		.max = max,
+		.file = file,
+		.line = line,
+		.done = false
+	};
+	return scope;
+}
+
+void cst_alloc_scope_end(cst_alloc_scope *scope)
+{
+	cst_alloc_stats stats = cst_get_alloc_stats();
+	size_t allocs = stats.allocs - scope->allocs;
+
+	scope->done = true;
+	if (allocs <= scope->max)
+		return;
+	cst_memcheck_depth++;
+	fprintf(stderr, CST_BRED"❌ %s"CST_RED, CST_TEST_NAME);
+	if (CST_SHOW_FAIL_DETAILS) {
+		fprintf(stderr, CST_GRAY": "CST_RED);
+		if (scope->max == 0)
+			fprintf(stderr, "Got %zu allocation(s) (%zu bytes) when expecting none",
+				allocs, stats.bytes - scope->bytes);
+		else
+			fprintf(stderr, "Got %zu allocation(s) (%zu bytes) when expecting at most %zu",
+				allocs, stats.bytes - scope->bytes, scope->max);
+		fprintf(stderr, " from block at %s:%d", scope->file, scope->line);
+	}
+	if (CST_FAIL_TIP != NULL)
+		fprintf(stderr, CST_GRAY" - "CST_RED"%s", CST_FAIL_TIP);
+	fprintf(stderr, "\n"CST_RES);
+	cst_memcheck_depth--;
+	cst_assert_failed(true);
+}
+
+/*
+ - Helper: Leaks grouped by allocation stack (-memstacks)
+ */
+
+typedef struct cst_leak_group {
+	const cst_alloc *first;
+	size_t count;
+	size_t bytes;
+} cst_leak_group;
+
+static int compare_leaks(const void *a, const void *b)
+{
+	const cst_alloc *la = a;
+	const cst_alloc *lb = b;
+
+	if (la->stack != lb->stack)
+		return (uintptr_t) la->stack < (uintptr_t) lb->stack ? -1 : 1;
+	if (la->file != lb->file)
+		return (uintptr_t) la->file < (uintptr_t) lb->file ? -1 : 1;
+	if (la->line != lb->line)
+		return la->line < lb->line ? -1 : 1;
+	if (la->caller != lb->caller)
+		return (uintptr_t) la->caller < (uintptr_t) lb->caller ? -1 : 1;
+	return la->tid < lb->tid ? -1 : (la->tid > lb->tid);
+}
+
+static int compare_groups(const void *a, const void *b)
+{
+	const cst_leak_group *ga = a;
+	const cst_leak_group *gb = b;
+
+	if (ga->bytes != gb->bytes)
+		return ga->bytes < gb->bytes ? 1 : -1;
+	return ga->count < gb->count ? 1 : (ga->count > gb->count ? -1 : 0);
+}
+
+static void print_leak_groups(cst_alloc *leaks, size_t count, int main_tid)
+{
+	char where[CST_PATH_MAX];
+	cst_leak_group *groups = __libc_malloc((count + 1) * sizeof(cst_leak_group));
+	size_t used = 0;
+
+	if (groups == NULL)
+		return;
+	qsort(leaks, count, sizeof(cst_alloc), compare_leaks);
+	for (size_t i = 0; i < count; i++) {
+		if (used == 0 || compare_leaks(groups[used - 1].first, &leaks[i]) != 0)
+			groups[used++] = (cst_leak_group) { .first = &leaks[i], .count = 0, .bytes = 0 };
+		groups[used - 1].count++;
+		groups[used - 1].bytes += leaks[i].size;
+	}
+	qsort(groups, used, sizeof(cst_leak_group), compare_groups);
+	for (size_t i = 0; i < used; i++) {
+		const cst_alloc *a = groups[i].first;
+		void *const *frames;
+		int depth = cst_stackdepot_frames(a->stack, &frames);
+
+		describe_site(where, sizeof(where), a->file, a->line, a->caller);
+		fprintf(stderr, CST_GRAY"  - "CST_BRED"%zu bytes "CST_GRAY"in "CST_BRED"%zu allocation(s) "CST_RED"%s",
+				groups[i].bytes, groups[i].count, where);
+		if (a->tid != main_tid)
+			fprintf(stderr, CST_GRAY" (thread %d)", a->tid);
+		fprintf(stderr, CST_RES"\n");
+		// The first frame is the allocating code, already described
+		for (int f = 1; f < depth; f++) {
+			describe_site(where, sizeof(where), NULL, 0, frames[f]);
+			fprintf(stderr, CST_GRAY"      %s"CST_RES"\n", where);
+		}
+	}
+	__libc_free(groups);
 }
 
 /*
  - Public API: Manual leak checking
  */
 
+bool cst_memguard_enabled(void)
+{
+	return g_guard_enabled;
+}
+
 bool cst_has_leaks(void)
 {
-	return g_allocs != NULL;
+	return live_alloc_count() != 0;
 }
 
 void cst_print_leaks(void)
 {
-	if (!g_allocs)
+	if (live_alloc_count() == 0)
 		return;  // Silent if no leaks
-	
+
 	size_t total_leaked = 0;
 	size_t leak_count = 0;
-	
+	int main_tid = (int) getpid();
+	char where[CST_PATH_MAX];
+
+	// Reporting may allocate (stdio, symbolization), don't track that
+	cst_memcheck_depth++;
+	cst_alloc *leaks = snapshot_allocs(&leak_count);
 	fprintf(stderr, CST_BRED"💧 %s "CST_GRAY"-"CST_RED" Memory leaks detected"CST_GRAY":"CST_RES"\n", CST_TEST_NAME);
-	
-	for (cst_alloc *a = g_allocs; a; a = a->next) {
-		fprintf(stderr, CST_GRAY"  - "CST_BRED"%zu bytes "CST_RED"at %s:%d"CST_RES"\n",
-				a->size, a->file, a->line);
+
+	for (size_t i = 0; i < leak_count; i++) {
+		cst_alloc *a = &leaks[i];
 		total_leaked += a->size;
-		leak_count++;
+		if (g_stacks_enabled)
+			continue;
+		describe_site(where, sizeof(where), a->file, a->line, a->caller);
+		if (a->tid != main_tid)
+			fprintf(stderr, CST_GRAY"  - "CST_BRED"%zu bytes "CST_RED"%s "CST_GRAY"(thread %d)"CST_RES"\n",
+					a->size, where, a->tid);
+		else
+			fprintf(stderr, CST_GRAY"  - "CST_BRED"%zu bytes "CST_RED"%s"CST_RES"\n",
+					a->size, where);
 	}
-	
+	if (g_stacks_enabled)
+		print_leak_groups(leaks, leak_count, main_tid);
+
 	fprintf(stderr, CST_BRED"  Total: %zu bytes in %zu allocation(s)"CST_RES"\n",
 			total_leaked, leak_count);
+	__libc_free(leaks);
+	cst_memcheck_depth--;
 }
 
 void cst_reset_memcheck(void)
 {
-	while (g_allocs) {
-		cst_alloc *tmp = g_allocs;
-		g_allocs = g_allocs->next;
-		free(tmp);
+	cst_mem_thread *self = current_thread();
+	unsigned int past = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED) - 1;
+
+	for (size_t i = 0; i < CST_ALLOC_SHARDS; i++) {
+		cst_alloc_shard *shard = &g_shards[i];
+		spin_lock(&shard->lock);
+		for (size_t b = 0; b < CST_SHARD_BUCKETS; b++) {
+			cst_alloc **curr = &shard->buckets[b];
+			while (*curr) {
+				cst_alloc *tmp = *curr;
+				// Guarded blocks stay known so freeing them finds their raw pointer
+				if (tmp->offset != 0) {
+					tmp->epoch = past;
+					curr = &tmp->next;
+					continue;
+				}
+				*curr = tmp->next;
+				shard->count--;
+				node_put(self, tmp);
+			}
+		}
+		shard->epoch_count = 0;
+		spin_unlock(&shard->lock);
+	}
+	g_live_bytes = 0;
+}
+
+/*
+ - Internal API: Forgets what the current epoch still has allocated, after
+ - reporting it as leaked by a row or a property run. Earlier memory of the
+ - process stays tracked, and guarded blocks are released as glibc only
+ - knows their raw pointer.
+ */
+
+void cst_forget_epoch(void)
+{
+	cst_mem_thread *self = current_thread();
+	unsigned int epoch = __atomic_load_n(&g_epoch, __ATOMIC_RELAXED);
+	cst_alloc *guarded = NULL;
+
+	for (size_t i = 0; i < CST_ALLOC_SHARDS; i++) {
+		cst_alloc_shard *shard = &g_shards[i];
+		spin_lock(&shard->lock);
+		for (size_t b = 0; b < CST_SHARD_BUCKETS; b++) {
+			cst_alloc **curr = &shard->buckets[b];
+			while (*curr) {
+				cst_alloc *tmp = *curr;
+				if (tmp->epoch != epoch) {
+					curr = &tmp->next;
+					continue;
+				}
+				*curr = tmp->next;
+				shard->count--;
+				if (tmp->offset != 0) {
+					tmp->next = guarded;
+					guarded = tmp;
+				} else
+					node_put(self, tmp);
+			}
+		}
+		if (shard->epoch == epoch)
+			shard->epoch_count = 0;
+		spin_unlock(&shard->lock);
+	}
+	g_live_bytes = 0;
+	// Outside of the shards, checking the redzones may report and exit
+	while (guarded != NULL) {
+		cst_alloc *next = guarded->next;
+		guard_release(guarded, NULL, 0, NULL);
+		node_put(self, guarded);
+		guarded = next;
 	}
 }
 
@@ -158,20 +1185,25 @@ void cst_reset_memcheck(void)
  */
 
 void cst_check_leaks_before_exit(void) {
+	cst_allocfail_finish();
+	cst_interpose_active = false;
+	if (g_sites != NULL) {
+		print_alloc_stats();
+		__libc_free(g_sites);
+		g_sites = NULL;
+	}
 	if (!g_memcheck_enabled)
 		return;
-	
-	if (g_allocs != NULL) {
+	if (g_guard_enabled)
+		guard_check_all();
+
+	if (live_alloc_count() != 0) {
 		cst_print_leaks();
-		
-		// Clean list to avoid double reports
-		while (g_allocs) {
-			cst_alloc *tmp = g_allocs;
-			g_allocs = g_allocs->next;
-			free(tmp);
-		}
-		
-		exit(EXIT_FAILURE);  // Force test failure
+
+		// Clean table to avoid double reports
+		cst_reset_memcheck();
+
+		exit(CST_EXIT_LEAK);  // Force test failure
 	}
 }
 
@@ -183,8 +1215,9 @@ __attribute__((destructor))
 static void cst_report_leaks(void)
 {
 	// This only runs if the process exits without calling cst_check_leaks_before_exit
-	if (!g_memcheck_enabled || !g_allocs)
+	cst_interpose_active = false;
+	if (!g_memcheck_enabled || live_alloc_count() == 0)
 		return;
-	
+
 	cst_print_leaks();
 }
@@ -0,0 +1,307 @@
+#define CST_NO_MEMCHECK  // Nothing here allocates, but diffs are no test's memory anyway
+#include "cst.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+/*
+ - Buffer comparisons
+ -
+ - Equal buffers cost a single memcmp(), which libc vectorizes. Only when
+ - they differ is the first mismatch searched for: memcmp() narrows it down
+ - to a chunk, then a word, and the word's first differing byte is found
+ - from the XOR of both words.
+ -
+ - Diffs are built by the assertion's message and printed right after it,
+ - see cst_print_diff.
+ */
+
+#define CST_MISMATCH_CHUNK 4096
+
+/* Elements shown around a mismatch in arrays */
+#define CST_DIFF_CONTEXT 3
+
+static __thread char t_diff[2048];
+static __thread size_t t_diff_len = 0;
+
+/* Returns the number of characters added */
+__attribute__((format(printf, 1, 2)))
+static size_t diff_add(const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	if (t_diff_len >= sizeof(t_diff) - 1)
+		return 0;
+	va_start(args, fmt);
+	n = vsnprintf(t_diff + t_diff_len, sizeof(t_diff) - t_diff_len, fmt, args);
+	va_end(args);
+	if (n < 0)
+		return 0;
+	if ((size_t) n >= sizeof(t_diff) - t_diff_len)
+		n = sizeof(t_diff) - t_diff_len - 1;
+	t_diff_len += (size_t) n;
+	return (size_t) n;
+}
+
+/* Called once an assertion's message is printed */
+void cst_print_diff(void)
+{
+	if (t_diff_len == 0)
+		return;
+	fprintf(stderr, "%s"CST_RES, t_diff);
+	t_diff_len = 0;
+}
+
+/*
+ - First mismatch search
+ */
+
+size_t cst_mem_mismatch(const void *actual, const void *expected, size_t len)
+{
+	const unsigned char *a = actual;
+	const unsigned char *b = expected;
+	size_t i = 0;
+
+	if (a == b || memcmp(a, b, len) == 0)
+		return len;
+	while (len - i > CST_MISMATCH_CHUNK && memcmp(a + i, b + i, CST_MISMATCH_CHUNK) == 0)
+		i += CST_MISMATCH_CHUNK;
+	for (; len - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+		uint64_t wa;
+		uint64_t wb;
+		memcpy(&wa, a + i, sizeof(wa));
+		memcpy(&wb, b + i, sizeof(wb));
+		if (wa != wb) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			return i + __builtin_ctzll(wa ^ wb) / 8;
+#else
+			return i + __builtin_clzll(wa ^ wb) / 8;
+#endif
+		}
+	}
+	while (i < len && a[i] == b[i])
+		i++;
+	return i;
+}
+
+/* Orders floats so that consecutive values are consecutive integers */
+static int64_t float_order(float f)
+{
+	int32_t bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	return bits < 0 ? (int64_t) INT32_MIN - bits : bits;
+}
+
+static int64_t double_order(double d)
+{
+	int64_t bits;
+
+	memcpy(&bits, &d, sizeof(bits));
+	return bits < 0 ? INT64_MIN - bits : bits;
+}
+
+static uint64_t order_distance(int64_t a, int64_t b)
+{
+	return a > b ? (uint64_t) a - (uint64_t) b : (uint64_t) b - (uint64_t) a;
+}
+
+/* NaN matches NaN, infinities only match themselves */
+size_t cst_float_mismatch(const float *actual, const float *expected, size_t count, unsigned ulps, float rel)
+{
+	for (size_t i = 0; i < count; i++) {
+		float a = actual[i];
+		float e = expected[i];
+		if (a == e || (a != a && e != e))
+			continue;
+		if (a != a || e != e)
+			return i;
+		if (rel > 0 ? fabsf(a - e) > rel * (fabsf(a) > fabsf(e) ? fabsf(a) : fabsf(e))
+			: order_distance(float_order(a), float_order(e)) > ulps)
+			return i;
+	}
+	return count;
+}
+
+size_t cst_double_mismatch(const double *actual, const double *expected, size_t count, unsigned ulps, double rel)
+{
+	for (size_t i = 0; i < count; i++) {
+		double a = actual[i];
+		double e = expected[i];
+		if (a == e || (a != a && e != e))
+			continue;
+		if (a != a || e != e)
+			return i;
+		if (rel > 0 ? fabs(a - e) > rel * (fabs(a) > fabs(e) ? fabs(a) : fabs(e))
+			: order_distance(double_order(a), double_order(e)) > ulps)
+			return i;
+	}
+	return count;
+}
+
+/*
+ - Diffs, printed as the assertion's message
+ */
+
+/* Bytes missing from the shorter buffer show as blanks */
+static void hex_row(const char *label, const unsigned char *row, size_t len, const unsigned char *other, size_t other_len)
+{
+	diff_add(CST_GRAY"    %-9s", label);
+	for (size_t i = 0; i < 16; i++) {
+		if (i >= len)
+			diff_add("   ");
+		else
+			diff_add("%s%02x ", i >= other_len || row[i] != other[i] ? CST_BRED : CST_GRAY, row[i]);
+	}
+	diff_add(CST_GRAY"|");
+	for (size_t i = 0; i < len && i < 16; i++)
+		diff_add("%c", isprint(row[i]) ? row[i] : '.');
+	diff_add("|\n");
+}
+
+/* The mismatch's row, and the one before it */
+static void hex_rows(const unsigned char *a, size_t a_len, const unsigned char *b, size_t b_len, size_t at)
+{
+	size_t row = at & ~(size_t) 15;
+
+	for (row = row >= 16 ? row - 16 : 0; row <= at; row += 16) {
+		size_t na = a_len > row ? a_len - row : 0;
+		size_t nb = b_len > row ? b_len - row : 0;
+		diff_add(CST_GRAY"  %08zx\n", row);
+		hex_row("Got", a + row, na, b + row, nb);
+		hex_row("Expected", b + row, nb, a + row, na);
+	}
+}
+
+void cst_mem_diff(const void *actual, const void *expected, size_t len, size_t at)
+{
+	const unsigned char *a = actual;
+	const unsigned char *b = expected;
+
+	fprintf(stderr, "Got 0x%02x when expecting 0x%02x at offset %zu (Of %zu bytes)", a[at], b[at], at, len);
+	hex_rows(a, len, b, len, at);
+}
+
+static void array_row(const char *label, const void *values, size_t size, size_t count, size_t at,
+	void (*print)(const void *))
+{
+	size_t from = at > CST_DIFF_CONTEXT ? at - CST_DIFF_CONTEXT : 0;
+	size_t to = count - at > CST_DIFF_CONTEXT ? at + CST_DIFF_CONTEXT + 1 : count;
+
+	diff_add(CST_GRAY"    %-9s%s{ ", label, from > 0 ? "... " : "");
+	for (size_t i = from; i < to; i++) {
+		diff_add(i == at ? CST_BRED : CST_RED);
+		print((const char *) values + i * size);
+		diff_add(i + 1 < to ? CST_GRAY", " : "");
+	}
+	diff_add(CST_GRAY"%s }\n", to < count ? " ..." : "");
+}
+
+static void print_int(const void *value)
+{
+	diff_add("%d", *(const int *) value);
+}
+
+static void print_float(const void *value)
+{
+	diff_add("%.9g", *(const float *) value);
+}
+
+static void print_double(const void *value)
+{
+	diff_add("%.17g", *(const double *) value);
+}
+
+void cst_int_diff(const int *actual, const int *expected, size_t count, size_t at)
+{
+	fprintf(stderr, "Got %d when expecting %d at index %zu (Of %zu)", actual[at], expected[at], at, count);
+	array_row("Got", actual, sizeof(int), count, at, print_int);
+	array_row("Expected", expected, sizeof(int), count, at, print_int);
+}
+
+void cst_float_diff(const float *actual, const float *expected, size_t count, size_t at)
+{
+	fprintf(stderr, "Got %.9g when expecting %.9g at index %zu (Of %zu)", actual[at], expected[at], at, count);
+	array_row("Got", actual, sizeof(float), count, at, print_float);
+	array_row("Expected", expected, sizeof(float), count, at, print_float);
+}
+
+void cst_double_diff(const double *actual, const double *expected, size_t count, size_t at)
+{
+	fprintf(stderr, "Got %.17g when expecting %.17g at index %zu (Of %zu)", actual[at], expected[at], at, count);
+	array_row("Got", actual, sizeof(double), count, at, print_double);
+	array_row("Expected", expected, sizeof(double), count, at, print_double);
+}
+
+/* Characters shown on each side of a text mismatch */
+#define CST_TEXT_CONTEXT 24
+
+/* Returns the width of the row up to the mismatch */
+static size_t text_row(const char *label, const char *text, size_t len, size_t at)
+{
+	size_t from = at > CST_TEXT_CONTEXT ? at - CST_TEXT_CONTEXT : 0;
+	size_t to = len > at + CST_TEXT_CONTEXT ? at + CST_TEXT_CONTEXT : len;
+	size_t width = 0;
+	size_t caret = 0;
+
+	diff_add(CST_GRAY"    %-9s%s\""CST_RED, label, from > 0 ? "..." : "");
+	for (size_t i = from; i < to; i++) {
+		unsigned char c = text[i];
+		if (i == at)
+			caret = width;
+		if (c == '\n')
+			width += diff_add("\\n");
+		else if (c == '\t')
+			width += diff_add("\\t");
+		else if (!isprint(c))
+			width += diff_add("\\x%02x", c);
+		else
+			width += diff_add("%c", c);
+	}
+	diff_add(CST_GRAY"\"%s\n", to < len ? "..." : "");
+	return at >= to ? width : caret;
+}
+
+static void text_rows(const char *actual, size_t actual_len, const char *expected, size_t expected_len, size_t at)
+{
+	size_t line = 1;
+	size_t column = 1;
+	size_t caret;
+
+	for (size_t i = 0; i < at; i++) {
+		column++;
+		if (actual[i] == '\n') {
+			line++;
+			column = 1;
+		}
+	}
+	fprintf(stderr, "Got different text at offset %zu (Line %zu, column %zu)", at, line, column);
+	caret = text_row("Got", actual, actual_len, at);
+	text_row("Expected", expected, expected_len, at);
+	// Under the mismatch, past the label, the ellipsis and the quote
+	diff_add(CST_BRED"%*s^\n", (int) (13 + (at > CST_TEXT_CONTEXT ? 3 : 0) + caret + 1), "");
+}
+
+void cst_text_diff(const char *actual, const char *expected, size_t at)
+{
+	text_rows(actual, strlen(actual), expected, strlen(expected), at);
+}
+
+/* Text, unless either buffer holds a NUL byte */
+void cst_buf_diff(const void *actual, size_t actual_len, const void *expected, size_t expected_len, size_t at)
+{
+	if (memchr(actual, '\0', actual_len) == NULL && memchr(expected, '\0', expected_len) == NULL) {
+		text_rows(actual, actual_len, expected, expected_len, at);
+		return;
+	}
+	if (at < actual_len && at < expected_len)
+		fprintf(stderr, "Got 0x%02x when expecting 0x%02x at offset %zu",
+			((const unsigned char *) actual)[at], ((const unsigned char *) expected)[at], at);
+	else
+		fprintf(stderr, "Got %zu bytes when expecting %zu (Equal up to there)", actual_len, expected_len);
+	hex_rows(actual, actual_len, expected, expected_len, at);
+}
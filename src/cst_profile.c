@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // Profiling data isn't part of the test
+#include "cst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+/*
+ - Sampling profiler (-profile)
+ -
+ - Each test arms a CPU time timer, and every SIGPROF stores the raw frames
+ - of the interrupted thread in a ring preallocated by the runner. Once the
+ - test is over, its identical stacks are merged and appended to a scratch
+ - file, and the runner symbolizes everything once, at the end of the run,
+ - into folded stacks ("test;caller;callee count") for flame graph tools.
+ -
+ - backtrace() is used rather than frame pointers, as it unwinds through
+ - the signal frame and through libraries built without them. It's warmed
+ - up by the runner so it doesn't load anything from the handler.
+ */
+
+#define CST_PROFILE_HZ 997
+#define CST_PROFILE_DEPTH 48
+#define CST_PROFILE_SAMPLES 16384
+
+/* Frames of the handler itself and of the signal trampoline */
+#define CST_PROFILE_SKIP 2
+
+typedef struct cst_sample {
+	uint32_t count;
+	uint32_t depth;
+	void *frames[CST_PROFILE_DEPTH];
+} cst_sample;
+
+typedef struct cst_profiled {
+	const char *category;
+	const char *name;
+	void (*func)(void);
+	off_t start;
+	off_t end;
+} cst_profiled;
+
+static bool g_enabled = false;
+static const char *g_path = NULL;
+static int g_fd = -1;
+static cst_sample *g_ring = NULL;
+static size_t g_taken = 0;
+static pid_t g_test_pid = 0;
+static cst_profiled *g_tests = NULL;
+static size_t g_test_count = 0;
+static off_t g_offset = 0;
+
+/*
+ - From cst_backtrace.c
+ */
+
+bool	cst_bt_function(void *addr, char *buf, size_t size);
+
+/*
+ - Test side
+ */
+
+static void cst_profile_handler(int signum, siginfo_t *info, void *uctx)
+{
+	void *frames[CST_PROFILE_DEPTH + CST_PROFILE_SKIP];
+	size_t slot = __atomic_fetch_add(&g_taken, 1, __ATOMIC_RELAXED) % CST_PROFILE_SAMPLES;
+	int n = backtrace(frames, CST_PROFILE_DEPTH + CST_PROFILE_SKIP);
+
+	(void) signum;
+	(void) info;
+	(void) uctx;
+	if (n <= CST_PROFILE_SKIP) {
+		g_ring[slot].count = 0;
+		return;
+	}
+	// Past the ring's capacity, only the latest samples are kept
+	g_ring[slot].count = 1;
+	g_ring[slot].depth = n - CST_PROFILE_SKIP;
+	memcpy(g_ring[slot].frames, frames + CST_PROFILE_SKIP, (n - CST_PROFILE_SKIP) * sizeof(void *));
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	const cst_sample *sa = a;
+	const cst_sample *sb = b;
+
+	if (sa->depth != sb->depth)
+		return sa->depth < sb->depth ? -1 : 1;
+	return memcmp(sa->frames, sb->frames, sa->depth * sizeof(void *));
+}
+
+/* Merges identical stacks and sends them to the runner, once per test */
+void cst_profile_test_end(void)
+{
+	struct itimerval off = {0};
+	size_t count = g_taken < CST_PROFILE_SAMPLES ? g_taken : CST_PROFILE_SAMPLES;
+	size_t merged = 0;
+
+	if (!g_enabled || g_test_pid != getpid())
+		return;
+	g_test_pid = 0;
+	setitimer(ITIMER_PROF, &off, NULL);
+	signal(SIGPROF, SIG_IGN);
+	qsort(g_ring, count, sizeof(cst_sample), compare_samples);
+	for (size_t i = 0; i < count; i++) {
+		if (g_ring[i].count == 0)
+			continue;
+		if (merged > 0 && compare_samples(&g_ring[merged - 1], &g_ring[i]) == 0)
+			g_ring[merged - 1].count++;
+		else
+			g_ring[merged++] = g_ring[i];
+	}
+	for (size_t i = 0; i < merged; i++) {
+		size_t len = offsetof(cst_sample, frames) + g_ring[i].depth * sizeof(void *);
+		if (write(g_fd, &g_ring[i], len) != (ssize_t) len)
+			break;
+	}
+}
+
+void cst_profile_test_start(void)
+{
+	struct sigaction sa;
+	struct itimerval timer = {0};
+
+	if (!g_enabled)
+		return;
+	g_test_pid = getpid();
+	g_taken = 0;
+	atexit(cst_profile_test_end);  // Assertions end tests with exit()
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_sigaction = cst_profile_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigaction(SIGPROF, &sa, NULL);
+	timer.it_interval.tv_usec = 1000000 / CST_PROFILE_HZ;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/*
+ - Runner side
+ */
+
+void cst_profile_init(const char *path)
+{
+	char scratch[] = "/tmp/cst-profile-XXXXXX";
+	void *warmup[1];
+
+	if (path == NULL)
+		return;
+	g_fd = mkstemp(scratch);
+	if (g_fd == -1)
+		return;
+	unlink(scratch);
+	g_ring = mmap(NULL, CST_PROFILE_SAMPLES * sizeof(cst_sample), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (g_ring == MAP_FAILED) {
+		close(g_fd);
+		g_fd = -1;
+		return;
+	}
+	fcntl(g_fd, F_SETFL, O_APPEND);
+	backtrace(warmup, 1);
+	g_path = path;
+	g_enabled = true;
+}
+
+/* Called by the runner once a test is reaped */
+void cst_profile_test_done(const char *category, const char *name, void (*func)(void))
+{
+	off_t end;
+	cst_profiled *grown;
+
+	if (!g_enabled || (end = lseek(g_fd, 0, SEEK_END)) == -1)
+		return;
+	if (end > g_offset && (grown = realloc(g_tests, (g_test_count + 1) * sizeof(cst_profiled))) != NULL) {
+		g_tests = grown;
+		g_tests[g_test_count++] = (cst_profiled) {
+			.category = category,
+			.name = name,
+			.func = func,
+			.start = g_offset,
+			.end = end
+		};
+	}
+	g_offset = end;
+}
+
+/*
+ - Helper: Symbolization, each address once for the whole run
+ */
+
+typedef struct cst_profile_sym {
+	void *addr;
+	char *name;
+} cst_profile_sym;
+
+/* Must be a power of two */
+#define CST_PROFILE_SYMS 16384
+
+static size_t g_syms_used = 0;
+
+static const char *frame_name(cst_profile_sym *syms, void *addr, bool leaf)
+{
+	static char name[256];
+	size_t i = (size_t) (((uintptr_t) addr * 0x9E3779B97F4A7C15ULL) >> 40) & (CST_PROFILE_SYMS - 1);
+
+	while (syms[i].addr != NULL && syms[i].addr != addr)
+		i = (i + 1) & (CST_PROFILE_SYMS - 1);
+	if (syms[i].addr == addr)
+		return syms[i].name;
+	// Return addresses point past the call, step back into it
+	if (!cst_bt_function(leaf ? addr : (char *) addr - 1, name, sizeof(name)))
+		snprintf(name, sizeof(name), "%p", addr);
+	// Half full at most, so probing stays short
+	if (g_syms_used >= CST_PROFILE_SYMS / 2 || (syms[i].name = strdup(name)) == NULL)
+		return name;
+	syms[i].addr = addr;
+	g_syms_used++;
+	return syms[i].name;
+}
+
+typedef struct cst_folded {
+	char *stack;
+	size_t count;
+} cst_folded;
+
+/* Semicolons separate frames in folded stacks */
+static size_t append_frame(char *line, size_t len, size_t size, const char *name)
+{
+	if (len + 1 >= size)
+		return len;
+	line[len++] = ';';
+	for (; *name != '\0' && len + 1 < size; name++)
+		line[len++] = *name == ';' ? ':' : *name;
+	line[len] = '\0';
+	return len;
+}
+
+/* "category;test;caller;callee", where `root` is the test function if known */
+static char *fold_sample(cst_profile_sym *syms, const cst_profiled *test, const char *root, const cst_sample *sample)
+{
+	char line[4096];
+	size_t len = 0;
+	int top = (int) sample->depth - 1;
+
+	// Frames above the test function belong to the runner
+	for (int i = top; root != NULL && i >= 0; i--) {
+		if (strcmp(frame_name(syms, sample->frames[i], i == 0), root) == 0) {
+			top = i - 1;  // Shown by its test name
+			break;
+		}
+	}
+	line[0] = '\0';
+	len = append_frame(line, len, sizeof(line), test->category[0] != '\0' ? test->category : "Tests");
+	len = append_frame(line, len, sizeof(line), test->name);
+	for (int i = top; i >= 0; i--)
+		len = append_frame(line, len, sizeof(line), frame_name(syms, sample->frames[i], i == 0));
+	return strdup(line + 1);
+}
+
+static int compare_folded(const void *a, const void *b)
+{
+	return strcmp(((const cst_folded *) a)->stack, ((const cst_folded *) b)->stack);
+}
+
+/* Returns the number of samples of the test */
+static size_t write_test(FILE *out, cst_profile_sym *syms, const cst_profiled *test)
+{
+	cst_sample sample;
+	cst_folded *folded = NULL;
+	size_t count = 0;
+	size_t samples = 0;
+	off_t off = test->start;
+	char root[256];
+	bool rooted = test->func != NULL && cst_bt_function((void *) test->func, root, sizeof(root));
+
+	while (off < test->end) {
+		size_t head = offsetof(cst_sample, frames);
+		if (pread(g_fd, &sample, head, off) != (ssize_t) head || sample.depth > CST_PROFILE_DEPTH)
+			break;
+		size_t len = sample.depth * sizeof(void *);
+		if (pread(g_fd, sample.frames, len, off + head) != (ssize_t) len)
+			break;
+		off += head + len;
+		cst_folded *grown = realloc(folded, (count + 1) * sizeof(cst_folded));
+		if (grown == NULL)
+			break;
+		folded = grown;
+		folded[count].stack = fold_sample(syms, test, rooted ? root : NULL, &sample);
+		folded[count].count = sample.count;
+		if (folded[count].stack != NULL)
+			count++;
+	}
+	qsort(folded, count, sizeof(cst_folded), compare_folded);
+	for (size_t i = 0; i < count; i++) {
+		size_t total = folded[i].count;
+		while (i + 1 < count && strcmp(folded[i].stack, folded[i + 1].stack) == 0) {
+			free(folded[i].stack);
+			total += folded[++i].count;
+		}
+		fprintf(out, "%s %zu\n", folded[i].stack, total);
+		free(folded[i].stack);
+		samples += total;
+	}
+	free(folded);
+	return samples;
+}
+
+/* Called by the runner at the end of the run */
+void cst_profile_finish(void)
+{
+	size_t samples = 0;
+	cst_profile_sym *syms;
+	FILE *out;
+
+	if (!g_enabled)
+		return;
+	syms = calloc(CST_PROFILE_SYMS, sizeof(cst_profile_sym));
+	out = fopen(g_path, "w");
+	if (syms == NULL || out == NULL) {
+		fprintf(stderr, CST_BRED"❌ Could not write profile to %s"CST_RES"\n", g_path);
+		free(syms);
+		if (out != NULL)
+			fclose(out);
+		return;
+	}
+	for (size_t t = 0; t < g_test_count; t++)
+		samples += write_test(out, syms, &g_tests[t]);
+	fclose(out);
+	for (size_t i = 0; i < CST_PROFILE_SYMS; i++)
+		free(syms[i].name);
+	free(syms);
+	free(g_tests);
+	close(g_fd);
+	printf(CST_GRAY"📈 "CST_BLUE"%zu sample(s) from %zu test(s) written to %s"CST_RES"\n",
+		samples, g_test_count, g_path);
+}
@@ -0,0 +1,442 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // Generated values belong to CST, not to the test
+#include "cst.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ - Property-based testing (PROPERTY)
+ -
+ - Generators don't draw values directly, but raw choices, which are
+ - recorded. A run is fully described by its choices, so a failing run can
+ - be replayed, and shrunk by deleting or lowering its choices: generators
+ - map lower choices to simpler values (Closer to zero, shorter, earlier in
+ - the charset), and missing choices read as zero, the simplest ones.
+ -
+ - All runs happen in the test's process, quietly, and failures are caught
+ - with a jump out of the property. Only the smallest failing run is then
+ - replayed out loud, as a regular test, to report it.
+ */
+
+void	*__libc_malloc(size_t size);
+void	__libc_free(void *ptr);
+
+/*
+ - From cst.c
+ */
+
+size_t	cst_failed_checks(void);
+
+/*
+ - From cst_memcheck.c
+ */
+
+void	cst_forget_epoch(void);
+
+/* Choices a single run may draw */
+#define CST_PROP_CHOICES 4096
+
+/* Runs spent shrinking a failure, at most */
+#define CST_PROP_SHRINKS 10000
+
+/* Generated buffers of a run, freed once it's over */
+#define CST_PROP_BUFFERS 256
+
+typedef struct cst_choices {
+	uint64_t values[CST_PROP_CHOICES];
+	size_t len;
+} cst_choices;
+
+static uint64_t g_seed = 0;
+static long g_runs = 1000;
+
+static uint64_t g_rng[4];
+static cst_choices g_run;
+static cst_choices g_best;
+static bool g_replaying = false;
+static bool g_verbose = false;
+static size_t g_pos = 0;
+static bool g_exploring = false;
+static pthread_t g_thread;
+static jmp_buf g_jump;
+static void *g_buffers[CST_PROP_BUFFERS];
+static size_t g_buffer_count = 0;
+
+/*
+ - Helper: Pseudo random numbers (xoshiro256**, seeded with splitmix64)
+ */
+
+static uint64_t splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t rng_next(void)
+{
+	uint64_t result = rotl(g_rng[1] * 5, 7) * 9;
+	uint64_t t = g_rng[1] << 17;
+
+	g_rng[2] ^= g_rng[0];
+	g_rng[3] ^= g_rng[1];
+	g_rng[1] ^= g_rng[2];
+	g_rng[0] ^= g_rng[3];
+	g_rng[2] ^= t;
+	g_rng[3] = rotl(g_rng[3], 45);
+	return result;
+}
+
+static void rng_seed(uint64_t seed, const char *name)
+{
+	// Each property gets its own stream, so adding one doesn't change the others
+	for (const char *c = name; *c != '\0'; c++)
+		seed = (seed ^ (unsigned char) *c) * 0x100000001B3ULL;
+	for (size_t i = 0; i < 4; i++)
+		g_rng[i] = splitmix64(&seed);
+}
+
+/*
+ - Helper: Choices
+ */
+
+static uint64_t draw(void)
+{
+	uint64_t choice;
+
+	if (g_replaying)
+		choice = g_pos < g_run.len ? g_run.values[g_pos] : 0;
+	else {
+		choice = rng_next();
+		// Small choices are simple values, which hit edge cases more often
+		if ((choice & 0xF) == 0)
+			choice = (choice >> 4) & 0xF;
+		if (g_pos < CST_PROP_CHOICES)
+			g_run.values[g_pos] = choice;
+	}
+	g_pos++;
+	return choice;
+}
+
+static void *buffer_new(size_t size)
+{
+	void *ptr;
+
+	if (g_buffer_count == CST_PROP_BUFFERS || (ptr = __libc_malloc(size == 0 ? 1 : size)) == NULL) {
+		fprintf(stderr, CST_BRED"❌ %s "CST_GRAY"-"CST_RED" Too many generated values in one run"CST_RES"\n",
+			CST_TEST_NAME);
+		exit(EXIT_FAILURE);
+	}
+	g_buffers[g_buffer_count++] = ptr;
+	return ptr;
+}
+
+static void buffers_free(void)
+{
+	while (g_buffer_count > 0)
+		__libc_free(g_buffers[--g_buffer_count]);
+}
+
+/*
+ - Generators, see cst.h
+ */
+
+long long cst_gen_int(long long min, long long max)
+{
+	uint64_t span;
+	uint64_t n;
+	long long base;
+	uint64_t up;
+	uint64_t down;
+	uint64_t m;
+	long long value;
+
+	if (min > max) {
+		value = min;
+		min = max;
+		max = value;
+	}
+	span = (uint64_t) max - (uint64_t) min + 1;
+	n = span == 0 ? draw() : draw() % span;
+	// Simplest values are the closest to zero, alternating around it
+	base = min > 0 ? min : max < 0 ? max : 0;
+	up = (uint64_t) max - (uint64_t) base;
+	down = (uint64_t) base - (uint64_t) min;
+	m = up < down ? up : down;
+	if (n <= 2 * m)
+		value = (long long) ((uint64_t) base + ((n & 1) ? (n + 1) / 2 : -(n / 2)));
+	else if (up > down)
+		value = (long long) ((uint64_t) base + (n - m));
+	else
+		value = (long long) ((uint64_t) base - (n - m));
+	if (g_verbose)
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"%lld"CST_RES"\n", value);
+	return value;
+}
+
+unsigned long long cst_gen_uint(unsigned long long min, unsigned long long max)
+{
+	unsigned long long span = max - min + 1;
+	unsigned long long value = min + (span == 0 ? draw() : draw() % span);
+
+	if (g_verbose)
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"%llu"CST_RES"\n", value);
+	return value;
+}
+
+bool cst_gen_bool(void)
+{
+	bool value = draw() & 1;
+
+	if (g_verbose)
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"%s"CST_RES"\n", value ? "true" : "false");
+	return value;
+}
+
+double cst_gen_double(double min, double max)
+{
+	double value = min + (max - min) * ((draw() >> 11) * 0x1.0p-53);
+
+	if (g_verbose)
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"%g"CST_RES"\n", value);
+	return value;
+}
+
+char *cst_gen_str(size_t max_len, const char *charset)
+{
+	static const char printable[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+	size_t len = draw() % (max_len + 1);
+	size_t count;
+	char *str = buffer_new(len + 1);
+
+	if (charset == NULL || charset[0] == '\0')
+		charset = printable;
+	count = strlen(charset);
+	for (size_t i = 0; i < len; i++)
+		str[i] = charset[draw() % count];
+	str[len] = '\0';
+	if (g_verbose)
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"\"%s\""CST_RES"\n", str);
+	return str;
+}
+
+void *cst_gen_bytes(size_t *len, size_t max_len)
+{
+	size_t size = draw() % (max_len + 1);
+	unsigned char *bytes = buffer_new(size);
+
+	for (size_t i = 0; i < size; i++)
+		bytes[i] = (unsigned char) draw();
+	if (len != NULL)
+		*len = size;
+	if (g_verbose) {
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"%zu byte(s)"CST_GRAY":"CST_RED, size);
+		for (size_t i = 0; i < size; i++)
+			fprintf(stderr, " %02x", bytes[i]);
+		fprintf(stderr, CST_RES"\n");
+	}
+	return bytes;
+}
+
+int *cst_gen_int_array(size_t *len, size_t max_len, int min, int max)
+{
+	size_t count = draw() % (max_len + 1);
+	int *array = buffer_new(count * sizeof(int));
+	bool verbose = g_verbose;
+
+	// Shown as a whole below
+	g_verbose = false;
+	for (size_t i = 0; i < count; i++)
+		array[i] = (int) cst_gen_int(min, max);
+	g_verbose = verbose;
+	if (len != NULL)
+		*len = count;
+	if (g_verbose) {
+		fprintf(stderr, CST_GRAY"    Generated "CST_RED"{");
+		for (size_t i = 0; i < count; i++)
+			fprintf(stderr, i == 0 ? "%d" : ", %d", array[i]);
+		fprintf(stderr, "}"CST_RES"\n");
+	}
+	return array;
+}
+
+/*
+ - Internal API: Called by cst_assert_failed, ends the current run if
+ - the property is being explored
+ */
+
+void cst_property_failed(bool fatal)
+{
+	if (!g_exploring || !pthread_equal(pthread_self(), g_thread))
+		return;
+	if (fatal)
+		longjmp(g_jump, 1);
+}
+
+/*
+ - Helper: Runs
+ */
+
+/* Returns true if the property fails with the current choices */
+static bool run_once(void (*body)(void))
+{
+	size_t checks = cst_failed_checks();
+	bool failed;
+
+	g_pos = 0;
+	if (setjmp(g_jump) == 0) {
+		body();
+		failed = cst_failed_checks() != checks;
+	} else
+		failed = true;
+	buffers_free();
+	// What a failed run allocated would be reported as leaks of the next ones
+	if (cst_has_leaks()) {
+		cst_forget_epoch();
+		failed = true;
+	}
+	if (!g_replaying)
+		g_run.len = g_pos < CST_PROP_CHOICES ? g_pos : CST_PROP_CHOICES;
+	else if (failed && g_pos < g_run.len)
+		g_run.len = g_pos;  // Unused choices are dropped
+	return failed;
+}
+
+/* Runs the candidate in g_run, keeps it as the best failure if it still fails */
+static bool try_candidate(void (*body)(void), size_t *budget)
+{
+	if (*budget == 0)
+		return false;
+	(*budget)--;
+	if (!run_once(body)) {
+		g_run = g_best;
+		return false;
+	}
+	g_best = g_run;
+	return true;
+}
+
+static size_t shrink(void (*body)(void))
+{
+	size_t budget = CST_PROP_SHRINKS;
+	size_t steps = 0;
+	bool progress = true;
+
+	g_replaying = true;
+	g_run = g_best;
+	while (progress && budget > 0) {
+		progress = false;
+		// Deleting choices removes whole values, such as array elements
+		for (size_t size = 8; size > 0; size /= 2) {
+			for (size_t i = 0; i + size <= g_best.len; ) {
+				memmove(g_run.values + i, g_run.values + i + size, (g_run.len - i - size) * sizeof(uint64_t));
+				g_run.len -= size;
+				if (try_candidate(body, &budget)) {
+					steps++;
+					progress = true;
+				} else
+					i++;
+			}
+		}
+		// Then each choice is lowered as much as possible
+		for (size_t i = 0; i < g_best.len; i++) {
+			uint64_t lo = 0;
+			uint64_t hi = g_best.values[i];
+			while (lo < hi && budget > 0) {
+				uint64_t mid = lo + (hi - lo) / 2;
+				g_run.values[i] = mid;
+				if (try_candidate(body, &budget)) {
+					steps++;
+					progress = true;
+					hi = g_best.values[i];
+				} else
+					lo = mid + 1;
+				if (i >= g_best.len)
+					break;
+			}
+		}
+	}
+	return steps;
+}
+
+/*
+ - Internal API: Called by cst.c
+ */
+
+void cst_property_init(uint64_t seed, long runs)
+{
+	g_seed = seed;
+	if (runs > 0)
+		g_runs = runs;
+}
+
+/* Runs the body of a PROPERTY, replays its smallest failure if it has one */
+void cst_property_run(void (*body)(void))
+{
+	int out = dup(STDOUT_FILENO);
+	int err = dup(STDERR_FILENO);
+	int devnull = open("/dev/null", O_WRONLY);
+	long runs = 0;
+	size_t steps = 0;
+	bool failed = false;
+
+	rng_seed(g_seed, CST_TEST_NAME);
+	g_thread = pthread_self();
+	// Runs are quiet, only the smallest failure is reported
+	fflush(stdout);
+	if (devnull != -1) {
+		dup2(devnull, STDOUT_FILENO);
+		dup2(devnull, STDERR_FILENO);
+		close(devnull);
+	}
+	g_exploring = true;
+	while (!failed && runs < g_runs) {
+		runs++;
+		failed = run_once(body);
+	}
+	if (failed) {
+		g_best = g_run;
+		steps = shrink(body);
+	}
+	g_exploring = false;
+	fflush(stdout);
+	if (out != -1) {
+		dup2(out, STDOUT_FILENO);
+		close(out);
+	}
+	if (err != -1) {
+		dup2(err, STDERR_FILENO);
+		close(err);
+	}
+	if (!failed)
+		return;
+	fprintf(stderr, CST_BRED"❌ %s "CST_GRAY"-"CST_RED" Falsified after %ld run(s), shrunk in %zu step(s)"
+		CST_GRAY" (Replay with "CST_RED"-seed=%llu"CST_GRAY"):"CST_RES"\n",
+		CST_TEST_NAME, runs, steps, (unsigned long long) g_seed);
+	// Replayed as a regular test, which reports the failure and ends or fails it
+	size_t checks = cst_failed_checks();
+	g_run = g_best;
+	g_replaying = true;
+	g_verbose = true;
+	g_pos = 0;
+	body();
+	g_verbose = false;
+	if (cst_failed_checks() != checks || cst_has_leaks())
+		return;
+	fprintf(stderr, CST_BRED"❌ %s "CST_GRAY"-"CST_RED" Counterexample passed when replayed (Flaky property)"CST_RES"\n",
+		CST_TEST_NAME);
+	cst_assert_failed(true);
+}
@@ -1,7 +1,18 @@
+#define _GNU_SOURCE
 #include "cst.h"
 #include <signal.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 /*
  - From cst.c
@@ -10,38 +21,412 @@
 bool	cst_is_on_test(void);
 
 /*
- - Signal handler
+ - From cst_backtrace.c
  */
 
-static void cst_sighandler(int signum)
+void	cst_bt_print_frames(void *const *addrs, int count);
+
+/*
+ - From cst_concurrent.c
+ */
+
+int		cst_worker_index(void);
+
+/*
+ - From cst_memcheck.c
+ */
+
+extern __thread int	cst_memcheck_depth;
+
+/*
+ - Crash capture
+ -
+ - Handlers run on a preallocated alternate stack, so stack overflows are
+ - caught too, and only do async-signal-safe work: the signal, its code,
+ - the fault address and the raw frames are written as one record to the
+ - runner (See cst_crash_defer_to), which formats and symbolizes it once
+ - the test is reaped. Crashing with a corrupted heap can't deadlock.
+ */
+
+typedef struct cst_crash {
+	int signum;
+	int pid;
+	int tid;
+	int worker;  // TEST_CONCURRENT worker that crashed, -1 if none
+	int code;
+	void *fault;
+	void *sp;  // Stack pointer at the time of the crash, if known
+	int size;
+	void *addrs[CST_MAX_BT];
+} cst_crash;
+
+/* Frames of the handler itself and of the signal trampoline */
+#define CST_CRASH_SKIP 2
+
+#define CST_ALTSTACK_SIZE (64 * 1024)
+
+/* Sent by the runner to a test that timed out, see cst_request_dump */
+#define CST_DUMP_SIGNAL (SIGRTMIN + 1)
+
+static char			g_altstack[CST_ALTSTACK_SIZE] __attribute__((aligned(16)));
+static cst_crash	g_crash;
+static int			g_report_fd = -1;
+static int			g_dumping = 0;
+static bool			g_handling = false;
+
+/*
+ - Helper: Async-signal-safe output
+ */
+
+static void put(const char *s)
+{
+	size_t len = strlen(s);
+
+	while (len > 0) {
+		ssize_t n = write(STDERR_FILENO, s, len);
+		if (n <= 0)
+			return;
+		s += n;
+		len -= n;
+	}
+}
+
+static void put_num(long n)
 {
-	if (signum == SIGINT || signum == SIGTERM || signum == SIGQUIT || signum == SIGHUP) {
-		if (!cst_is_on_test())
-			fprintf(stderr, CST_BRED"❌ CST terminated by signal %i (%s)\n"CST_RES, signum, strsignal(signum));
-	} else {
-		fprintf(stderr, CST_BRED"💥 %s "CST_GRAY"-"CST_RED" Crashed with signal %i (%s)\n"CST_RES,
-			CST_TEST_NAME, signum, strsignal(signum));
-		cst_bt_print_current(2);
+	char buf[24];
+	size_t i = sizeof(buf) - 1;
+	unsigned long v = n < 0 ? -(unsigned long) n : (unsigned long) n;
+
+	buf[i] = '\0';
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	if (n < 0)
+		buf[--i] = '-';
+	put(buf + i);
+}
+
+static const char *signal_name(int signum)
+{
+	switch (signum) {
+		case SIGABRT: return "Aborted";
+		case SIGFPE: return "Floating point exception";
+		case SIGILL: return "Illegal instruction";
+		case SIGSEGV: return "Segmentation fault";
+		case SIGBUS: return "Bus error";
+		case SIGINT: return "Interrupt";
+		case SIGTERM: return "Terminated";
+		case SIGQUIT: return "Quit";
+		case SIGHUP: return "Hangup";
+		default: return "Unknown signal";
 	}
+}
+
+static void *crash_sp(const void *uctx)
+{
+	const ucontext_t *uc = uctx;
+
+	if (uc == NULL)
+		return NULL;
+#if defined(__x86_64__)
+	return (void *) uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__i386__)
+	return (void *) uc->uc_mcontext.gregs[REG_ESP];
+#elif defined(__aarch64__)
+	return (void *) uc->uc_mcontext.sp;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ - Signal handlers
+ */
+
+static void cst_crash_handler(int signum, siginfo_t *info, void *uctx)
+{
+	g_crash.signum = signum;
+	g_crash.pid = getpid();
+	g_crash.tid = (int) syscall(SYS_gettid);
+	g_crash.worker = cst_worker_index();
+	g_crash.code = info != NULL ? info->si_code : 0;
+	g_crash.fault = info != NULL ? info->si_addr : NULL;
+	g_crash.sp = crash_sp(uctx);
+	g_crash.size = CST_DO_BACKTRACE ? backtrace(g_crash.addrs, CST_MAX_BT) : 0;
+	if (cst_is_on_test() && g_report_fd != -1
+		&& write(g_report_fd, &g_crash, sizeof(g_crash)) == (ssize_t) sizeof(g_crash))
+		_exit(EXIT_FAILURE);
+	// No runner to report to, say what we can
+	put(CST_BRED"💥 ");
+	put(cst_is_on_test() ? CST_TEST_NAME : "CST");
+	put(" "CST_GRAY"-"CST_RED" Crashed with signal ");
+	put_num(signum);
+	put(" (");
+	put(signal_name(signum));
+	put(")\n"CST_RES);
+	if (g_crash.size > CST_CRASH_SKIP)
+		backtrace_symbols_fd(g_crash.addrs + CST_CRASH_SKIP, g_crash.size - CST_CRASH_SKIP, STDERR_FILENO);
 	_exit(EXIT_FAILURE);
 }
 
+/*
+ - Stack dump of a hung test: the first thread to get the signal forwards
+ - it to every other thread, and each one sends its own frames. Records
+ - are on each thread's stack, as they may be written at the same time.
+ */
+
+/* What getdents64 fills its buffer with, glibc doesn't declare it */
+typedef struct cst_linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} cst_linux_dirent64;
+
+static void signal_other_threads(int signum)
+{
+	char buf[1024];
+	int self = (int) syscall(SYS_gettid);
+	int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	long n;
+
+	if (fd == -1)
+		return;
+	while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+		for (long off = 0; off < n; ) {
+			const char *name = buf + off + offsetof(cst_linux_dirent64, d_name);
+			unsigned short reclen;
+			int tid = 0;
+			memcpy(&reclen, buf + off + offsetof(cst_linux_dirent64, d_reclen), sizeof(reclen));
+			off += reclen;
+			if (name[0] < '0' || name[0] > '9')
+				continue;
+			for (const char *c = name; *c >= '0' && *c <= '9'; c++)
+				tid = tid * 10 + (*c - '0');
+			if (tid != self)
+				syscall(SYS_tgkill, getpid(), tid, signum);
+		}
+	}
+	close(fd);
+}
+
+static void cst_dump_handler(int signum, siginfo_t *info, void *uctx)
+{
+	cst_crash dump = {0};
+
+	(void) info;
+	if (__atomic_exchange_n(&g_dumping, 1, __ATOMIC_SEQ_CST) == 0)
+		signal_other_threads(signum);
+	dump.signum = signum;
+	dump.pid = getpid();
+	dump.tid = (int) syscall(SYS_gettid);
+	dump.worker = cst_worker_index();
+	dump.sp = crash_sp(uctx);
+	dump.size = backtrace(dump.addrs, CST_MAX_BT);
+	// Nothing to do if it fails, the test is killed after the grace period
+	if (g_report_fd != -1)
+		(void) !write(g_report_fd, &dump, sizeof(dump));
+}
+
+static void cst_stop_handler(int signum)
+{
+	if (!cst_is_on_test()) {
+		put(CST_BRED"❌ CST terminated by signal ");
+		put_num(signum);
+		put(" (");
+		put(signal_name(signum));
+		put(")\n"CST_RES);
+	}
+	_exit(EXIT_FAILURE);
+}
+
+/*
+ - Alternate stacks of other threads: the main thread's is inherited by
+ - tests, but every thread the test starts (TEST_CONCURRENT workers too)
+ - needs one of its own, or its stack overflows would go unreported.
+ - libcst defines pthread_create to give them one, like it does the
+ - allocator, and forwards it to glibc.
+ */
+
+typedef int (*cst_pthread_create_fn)(pthread_t *, const pthread_attr_t *, void *(*)(void *), void *);
+
+/* Kept after the alternate stack, in the same mapping */
+typedef struct cst_thread_start {
+	void *(*func)(void *);
+	void *arg;
+} cst_thread_start;
+
+#define CST_THREAD_MAP_SIZE (CST_ALTSTACK_SIZE + sizeof(cst_thread_start))
+
+static void free_altstack(void *map)
+{
+	stack_t ss = { .ss_sp = NULL, .ss_size = 0, .ss_flags = SS_DISABLE };
+
+	sigaltstack(&ss, NULL);
+	munmap(map, CST_THREAD_MAP_SIZE);
+}
+
+static void *thread_start(void *map)
+{
+	cst_thread_start start = *(cst_thread_start *) ((char *) map + CST_ALTSTACK_SIZE);
+	stack_t ss = { .ss_sp = map, .ss_size = CST_ALTSTACK_SIZE, .ss_flags = 0 };
+	void *res;
+
+	sigaltstack(&ss, NULL);
+	// Also run if the thread exits or is cancelled
+	pthread_cleanup_push(free_altstack, map);
+	res = start.func(start.arg);
+	pthread_cleanup_pop(1);
+	return res;
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*func)(void *), void *arg)
+{
+	static cst_pthread_create_fn real = NULL;
+	cst_pthread_create_fn create = __atomic_load_n(&real, __ATOMIC_ACQUIRE);
+
+	if (create == NULL) {
+		cst_memcheck_depth++;
+		create = (cst_pthread_create_fn) dlsym(RTLD_NEXT, "pthread_create");
+		cst_memcheck_depth--;
+		if (create == NULL)
+			return EAGAIN;
+		__atomic_store_n(&real, create, __ATOMIC_RELEASE);
+	}
+	if (!g_handling)
+		return create(thread, attr, func, arg);
+	void *map = mmap(NULL, CST_THREAD_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return create(thread, attr, func, arg);
+	*(cst_thread_start *) ((char *) map + CST_ALTSTACK_SIZE) = (cst_thread_start) { .func = func, .arg = arg };
+	int err = create(thread, attr, thread_start, map);
+	if (err != 0)
+		munmap(map, CST_THREAD_MAP_SIZE);
+	return err;
+}
+
+/*
+ - Internal API: Called by cst.c
+ */
+
 void cst_init_sighandler(void)
 {
-	static bool handling = false;
+	int crashes[] = { SIGABRT, SIGFPE, SIGILL, SIGSEGV, SIGBUS };
+	int stops[] = { SIGINT, SIGTERM, SIGQUIT, SIGHUP };
+	struct sigaction sa;
+	stack_t ss = { .ss_sp = g_altstack, .ss_size = sizeof(g_altstack), .ss_flags = 0 };
+	void *warmup[1];
 
-	if (handling)
+	if (g_handling)
 		return;
-	handling = true;
-	// Crash signals
-	signal(SIGABRT, cst_sighandler);
-	signal(SIGFPE,  cst_sighandler);
-	signal(SIGILL,  cst_sighandler);
-	signal(SIGSEGV, cst_sighandler);
-	signal(SIGBUS,  cst_sighandler);
+	g_handling = true;
+	// Tests are forks of this thread, they inherit its alternate stack
+	sigaltstack(&ss, NULL);
+	// backtrace() loads its unwinder on first use, which isn't signal safe
+	backtrace(warmup, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	// Crash signals, a crash while handling one is fatal
+	sa.sa_sigaction = cst_crash_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+	for (size_t i = 0; i < sizeof(crashes) / sizeof(crashes[0]); i++)
+		sigaction(crashes[i], &sa, NULL);
 	// Interruptions / terminations
-	signal(SIGINT,  cst_sighandler);
-	signal(SIGTERM, cst_sighandler);
-	signal(SIGQUIT, cst_sighandler);
-	signal(SIGHUP,  cst_sighandler);
+	sa.sa_handler = cst_stop_handler;
+	sa.sa_flags = SA_ONSTACK;
+	for (size_t i = 0; i < sizeof(stops) / sizeof(stops[0]); i++)
+		sigaction(stops[i], &sa, NULL);
+	// Stack dumps of hung tests, which only happen in a test
+	sa.sa_sigaction = cst_dump_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigaction(CST_DUMP_SIGNAL, &sa, NULL);
+}
+
+/*
+ - Crash reports, formatted by the runner
+ */
+
+void cst_crash_defer_to(int fd)
+{
+	g_report_fd = fd;
+}
+
+/* Asks a hung test to send the frames of all its threads, returns false if it can't */
+bool cst_request_dump(pid_t pid)
+{
+	struct sigaction sa;
+
+	if (sigaction(CST_DUMP_SIGNAL, NULL, &sa) == -1 || sa.sa_sigaction != cst_dump_handler)
+		return false;
+	return kill(pid, CST_DUMP_SIGNAL) == 0;
+}
+
+static const char *describe_code(int signum, int code)
+{
+	if (signum == SIGSEGV && code == SEGV_MAPERR)
+		return "Address not mapped";
+	if (signum == SIGSEGV && code == SEGV_ACCERR)
+		return "Invalid permissions for mapped object";
+	if (signum == SIGBUS && code == BUS_ADRALN)
+		return "Invalid address alignment";
+	if (signum == SIGBUS && code == BUS_ADRERR)
+		return "Nonexistent physical address";
+	if (signum == SIGBUS && code == BUS_OBJERR)
+		return "Object specific hardware error";
+	if (signum == SIGFPE && code == FPE_INTDIV)
+		return "Integer divide by zero";
+	if (signum == SIGFPE && code == FPE_INTOVF)
+		return "Integer overflow";
+	if (signum == SIGFPE && code == FPE_FLTDIV)
+		return "Floating point divide by zero";
+	if (signum == SIGILL && code == ILL_ILLOPC)
+		return "Illegal opcode";
+	if (signum == SIGILL && code == ILL_PRVOPC)
+		return "Privileged opcode";
+	return NULL;
+}
+
+/* Returns the signal the test crashed with once it's reported, or 0. Stack dumps are printed too */
+int cst_crash_report(int fd, const char *test_name)
+{
+	cst_crash crash;
+	int reported = 0;
+
+	while (read(fd, &crash, sizeof(crash)) == (ssize_t) sizeof(crash)) {
+		if (crash.signum == CST_DUMP_SIGNAL) {
+			fprintf(stderr, CST_GRAY"  Thread "CST_RED"%d"CST_GRAY"%s", crash.tid, crash.tid == crash.pid ? " (main)" : "");
+			if (crash.worker != -1)
+				fprintf(stderr, " (Worker %d)", crash.worker);
+			fprintf(stderr, ":"CST_RES"\n");
+			if (crash.size > CST_CRASH_SKIP && crash.size <= CST_MAX_BT)
+				cst_bt_print_frames(crash.addrs + CST_CRASH_SKIP, crash.size - CST_CRASH_SKIP);
+			continue;
+		}
+		reported = crash.signum;
+		fprintf(stderr, CST_BRED"💥 %s", test_name);
+		if (crash.worker != -1)
+			fprintf(stderr, " [thread %d]", crash.worker);
+		fprintf(stderr, " "CST_GRAY"-"CST_RED" Crashed with signal %i (%s)\n"CST_RES,
+			crash.signum, strsignal(crash.signum));
+		if (crash.signum == SIGSEGV || crash.signum == SIGBUS || crash.signum == SIGILL || crash.signum == SIGFPE) {
+			const char *what = describe_code(crash.signum, crash.code);
+			uintptr_t fault = (uintptr_t) crash.fault;
+			uintptr_t sp = (uintptr_t) crash.sp;
+			fprintf(stderr, CST_GRAY"    at address "CST_RED"%p"CST_GRAY" (", crash.fault);
+			if (what != NULL)
+				fprintf(stderr, "%s", what);
+			else
+				fprintf(stderr, "Code %d", crash.code);
+			// Faults right below the stack pointer come from running out of stack
+			if (crash.signum == SIGSEGV && sp != 0 && fault <= sp + 4096 && fault + CST_ALTSTACK_SIZE >= sp)
+				fprintf(stderr, ", "CST_RED"Stack overflow"CST_GRAY);
+			fprintf(stderr, ")"CST_RES"\n");
+		}
+		if (CST_DO_BACKTRACE && crash.size > CST_CRASH_SKIP && crash.size <= CST_MAX_BT)
+			cst_bt_print_frames(crash.addrs + CST_CRASH_SKIP, crash.size - CST_CRASH_SKIP);
+	}
+	return reported;
 }
@@ -0,0 +1,161 @@
+#define CST_NO_MEMCHECK  // Snapshots are mapped, never allocated
+#include "cst.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ - Snapshots (ASSERT_MATCHES_SNAPSHOT)
+ -
+ - Golden files live in cst-snapshots/<category>/<test>/<name>. They're
+ - mapped rather than read, so comparing against a large one only touches
+ - its pages once, through the same first-mismatch search as the other
+ - buffer assertions. A mismatching snapshot stays mapped until its diff is
+ - printed, or until the next comparison.
+ -
+ - With -update-snapshots, snapshots that are missing or differ are
+ - rewritten (Through a rename, so an interrupted run never leaves a
+ - truncated one) and the assertion passes.
+ */
+
+#define CST_SNAPSHOT_DIR "cst-snapshots"
+
+/* Returned by cst_snapshot_compare when the snapshot matches */
+#define CST_SNAPSHOT_MATCH ((size_t) -1)
+
+static bool g_update = false;
+
+static __thread const void *t_mapped = NULL;
+static __thread size_t t_mapped_len = 0;
+static __thread char t_path[CST_PATH_MAX];
+static __thread bool t_missing = false;
+static __thread int t_write_error = 0;
+
+/*
+ - From cst_memutil.c
+ */
+
+void	cst_buf_diff(const void *actual, size_t actual_len, const void *expected, size_t expected_len, size_t at);
+
+void cst_snapshot_init(bool update)
+{
+	g_update = update;
+}
+
+/* Appends `name` as a single path component */
+static size_t append_component(char *buf, size_t len, size_t size, const char *name)
+{
+	if (len + 1 >= size)
+		return len;
+	buf[len++] = '/';
+	if (*name == '\0')
+		name = "_";
+	for (; *name != '\0' && len + 1 < size; name++) {
+		bool hidden = *name == '.' && buf[len - 1] == '/';
+		buf[len++] = *name == '/' || hidden ? '_' : *name;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+static void snapshot_unmap(void)
+{
+	if (t_mapped != NULL && t_mapped_len > 0)
+		munmap((void *) t_mapped, t_mapped_len);
+	t_mapped = NULL;
+	t_mapped_len = 0;
+}
+
+static bool snapshot_map(void)
+{
+	struct stat st;
+	int fd = open(t_path, O_RDONLY | O_CLOEXEC);
+
+	t_missing = fd == -1;
+	if (fd == -1)
+		return false;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return false;
+	}
+	t_mapped = "";
+	t_mapped_len = (size_t) st.st_size;
+	if (t_mapped_len > 0 && (t_mapped = mmap(NULL, t_mapped_len, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		t_mapped = NULL;
+		t_mapped_len = 0;
+	}
+	close(fd);
+	return t_mapped != NULL;
+}
+
+static bool snapshot_write(const void *buf, size_t len)
+{
+	char tmp[CST_PATH_MAX + 8];
+	int fd;
+	bool written;
+
+	// Creates the category and test directories on the way
+	for (char *slash = strchr(t_path, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		mkdir(t_path, 0755);
+		*slash = '/';
+	}
+	snprintf(tmp, sizeof(tmp), "%s.%d", t_path, (int) getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return false;
+	written = len == 0 || write(fd, buf, len) == (ssize_t) len;
+	close(fd);
+	if (!written || rename(tmp, t_path) == -1) {
+		unlink(tmp);
+		return false;
+	}
+	return true;
+}
+
+size_t cst_snapshot_compare(const void *buf, size_t len, const char *name)
+{
+	size_t path_len = (size_t) snprintf(t_path, sizeof(t_path), "%s", CST_SNAPSHOT_DIR);
+	size_t at;
+
+	snapshot_unmap();
+	t_write_error = 0;
+	path_len = append_component(t_path, path_len, sizeof(t_path), CST_TEST_CATEGORY);
+	path_len = append_component(t_path, path_len, sizeof(t_path), CST_TEST_NAME);
+	append_component(t_path, path_len, sizeof(t_path), name);
+	if (!snapshot_map() && !g_update)
+		return 0;
+	at = t_mapped == NULL ? 0 : cst_mem_mismatch(buf, t_mapped, len < t_mapped_len ? len : t_mapped_len);
+	if (t_mapped != NULL && at == len && len == t_mapped_len) {
+		snapshot_unmap();
+		return CST_SNAPSHOT_MATCH;
+	}
+	if (!g_update)
+		return at;
+	snapshot_unmap();
+	if (!snapshot_write(buf, len)) {
+		t_write_error = errno;
+		return 0;
+	}
+	fprintf(stderr, CST_GRAY"📸 "CST_BLUE"%s snapshot %s"CST_RES"\n", t_missing ? "Wrote" : "Updated", t_path);
+	return CST_SNAPSHOT_MATCH;
+}
+
+void cst_snapshot_diff(const void *buf, size_t len, size_t at)
+{
+	if (t_write_error != 0) {
+		fprintf(stderr, "Could not write snapshot %s (%s)", t_path, strerror(t_write_error));
+		return;
+	}
+	if (t_mapped == NULL) {
+		fprintf(stderr, "No snapshot at %s, run with -update-snapshots to write it", t_path);
+		return;
+	}
+	cst_buf_diff(buf, len, t_mapped, t_mapped_len, at);
+	fprintf(stderr, CST_GRAY" (%s)"CST_RED, t_path);
+	snapshot_unmap();
+}
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // The depot is part of memcheck itself
+#include "cst.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ - Allocation stacks (-memstacks)
+ -
+ - Stacks are captured by walking the frame pointer chain, which only costs
+ - a few loads per frame, so frames of code built without frame pointers
+ - (-fno-omit-frame-pointer) may be missing. Each unique stack is stored
+ - once in an insert-only depot, and allocations only keep a pointer to it,
+ - so identical stacks are compared by pointer when grouping leaks.
+ */
+
+void	*__libc_malloc(size_t size);
+void	*__libc_calloc(size_t nmemb, size_t size);
+
+/*
+ - From cst_memcheck.c
+ */
+
+extern __thread int	cst_memcheck_depth;
+
+/* Top of the main thread's stack, set by glibc */
+extern void	*__libc_stack_end;
+
+typedef struct cst_stack {
+	uint64_t hash;
+	int depth;
+	void *frames[];
+} cst_stack;
+
+/* Must be a power of two */
+#define CST_DEPOT_SLOTS 65536
+#define CST_DEPOT_CHUNK (64 * 1024)
+
+/* Frames that may belong to CST itself, on top of the requested depth */
+#define CST_STACK_SLACK 8
+
+static cst_stack **g_depot = NULL;
+static size_t g_depot_used = 0;
+static char *g_chunk = NULL;
+static size_t g_chunk_left = 0;
+static int g_chunk_lock = 0;
+static __thread uintptr_t t_stack_hi = 0;
+
+/*
+ - Helper: Bounds of the current thread's stack, computed once
+ */
+
+static uintptr_t stack_top(void)
+{
+	pthread_attr_t attr;
+	void *addr;
+	size_t size;
+
+	if (t_stack_hi != 0)
+		return t_stack_hi;
+	if (syscall(SYS_gettid) == getpid())
+		t_stack_hi = (uintptr_t) __libc_stack_end;
+	else {
+		// May allocate, which mustn't be tracked
+		cst_memcheck_depth++;
+		if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+			if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+				t_stack_hi = (uintptr_t) addr + size;
+			pthread_attr_destroy(&attr);
+		}
+		cst_memcheck_depth--;
+	}
+	return t_stack_hi;
+}
+
+/*
+ - Helper: Frame pointer unwinding
+ */
+
+__attribute__((noinline))
+static int unwind(void **frames, int max)
+{
+	uintptr_t fp = (uintptr_t) __builtin_frame_address(0);
+	uintptr_t hi = stack_top();
+	int n = 0;
+
+	while (n < max && fp != 0 && (fp & (sizeof(void *) - 1)) == 0 && fp + 2 * sizeof(void *) <= hi) {
+		uintptr_t *frame = (uintptr_t *) fp;
+		uintptr_t next = frame[0];
+		if (frame[1] == 0)
+			break;
+		frames[n++] = (void *) frame[1];
+		// Callers live higher up the stack, anything else is not a frame
+		if (next <= fp)
+			break;
+		fp = next;
+	}
+	return n;
+}
+
+/*
+ - Internal API: Fork safety, see cst_memcheck_atfork_*
+ */
+
+void cst_stackdepot_lock(void)
+{
+	while (__atomic_exchange_n(&g_chunk_lock, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+void cst_stackdepot_unlock(void)
+{
+	__atomic_store_n(&g_chunk_lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ - Helper: Depot storage, entries are never freed
+ */
+
+static cst_stack *stack_new(uint64_t hash, void *const *frames, int depth)
+{
+	size_t size = sizeof(cst_stack) + depth * sizeof(void *);
+	cst_stack *stack = NULL;
+
+	size = (size + 15) & ~(size_t) 15;
+	cst_stackdepot_lock();
+	if (g_chunk_left < size) {
+		g_chunk = __libc_malloc(CST_DEPOT_CHUNK);
+		g_chunk_left = g_chunk != NULL ? CST_DEPOT_CHUNK : 0;
+	}
+	if (g_chunk_left >= size) {
+		stack = (cst_stack *) g_chunk;
+		g_chunk += size;
+		g_chunk_left -= size;
+	}
+	cst_stackdepot_unlock();
+	if (stack == NULL)
+		return NULL;
+	stack->hash = hash;
+	stack->depth = depth;
+	memcpy(stack->frames, frames, depth * sizeof(void *));
+	return stack;
+}
+
+static uint64_t hash_frames(void *const *frames, int depth)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (int i = 0; i < depth; i++) {
+		hash ^= (uint64_t) (uintptr_t) frames[i];
+		hash *= 0x100000001B3ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+static const cst_stack *depot_intern(void *const *frames, int depth)
+{
+	uint64_t hash = hash_frames(frames, depth);
+	size_t i = (size_t) hash & (CST_DEPOT_SLOTS - 1);
+	cst_stack *fresh = NULL;
+
+	// Open addressing, slots are only ever filled once
+	for (size_t probes = 0; probes < CST_DEPOT_SLOTS; probes++) {
+		cst_stack *slot = __atomic_load_n(&g_depot[i], __ATOMIC_ACQUIRE);
+		if (slot == NULL) {
+			// The depot is too full to probe any further
+			if (__atomic_load_n(&g_depot_used, __ATOMIC_RELAXED) >= CST_DEPOT_SLOTS / 4 * 3)
+				return NULL;
+			if (fresh == NULL && (fresh = stack_new(hash, frames, depth)) == NULL)
+				return NULL;
+			if (__atomic_compare_exchange_n(&g_depot[i], &slot, fresh, false,
+					__ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+				__atomic_add_fetch(&g_depot_used, 1, __ATOMIC_RELAXED);
+				return fresh;
+			}
+			// Another thread took it first, check what it stored
+		}
+		if (slot->hash == hash && slot->depth == depth
+			&& memcmp(slot->frames, frames, depth * sizeof(void *)) == 0)
+			return slot;  // Any fresh entry is wasted, which is rare and harmless
+		i = (i + 1) & (CST_DEPOT_SLOTS - 1);
+	}
+	return NULL;
+}
+
+/*
+ - Internal API: Used by memcheck
+ */
+
+bool cst_stackdepot_init(void)
+{
+	if (g_depot == NULL)
+		g_depot = __libc_calloc(CST_DEPOT_SLOTS, sizeof(cst_stack *));
+	return g_depot != NULL;
+}
+
+/* Captures the current stack, starting at `caller` (The allocating code) */
+const void *cst_stackdepot_capture(void *caller)
+{
+	void *frames[CST_ALLOC_BT + CST_STACK_SLACK];
+	int n = unwind(frames, CST_ALLOC_BT + CST_STACK_SLACK);
+	int start = -1;
+
+	if (g_depot == NULL)
+		return NULL;
+	// Skip CST's own frames, whose count depends on the allocation path
+	for (int i = 0; i < n && start == -1; i++)
+		if (frames[i] == caller)
+			start = i;
+	if (start == -1) {
+		// The chain is broken below the caller, only the caller is known
+		frames[0] = caller;
+		n = caller != NULL;
+		start = 0;
+	}
+	n -= start;
+	if (n > CST_ALLOC_BT)
+		n = CST_ALLOC_BT;
+	if (n <= 0)
+		return NULL;
+	return depot_intern(frames + start, n);
+}
+
+int cst_stackdepot_frames(const void *stack, void *const **frames)
+{
+	const cst_stack *s = stack;
+
+	if (s == NULL)
+		return 0;
+	*frames = s->frames;
+	return s->depth;
+}
@@ -0,0 +1,716 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // Symbol tables live for the whole process
+#include "cst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ - In-process symbolizer
+ -
+ - Modules (The executable and shared libraries) are mapped and parsed once,
+ - the first time one of their addresses is resolved: functions come from
+ - .symtab (Or .dynsym when stripped) and lines from the DWARF .debug_line
+ - programs, which are run once into a table sorted by address. Resolving
+ - an address is then two binary searches, instead of an addr2line process.
+ -
+ - Compressed debug sections and separate debug files aren't supported,
+ - such modules only resolve to function names.
+ */
+
+typedef struct cst_sym {
+	uintptr_t addr;
+	size_t size;
+	const char *name;
+} cst_sym;
+
+typedef struct cst_line_file {
+	const char *name;
+	const char *dir;
+} cst_line_file;
+
+/* File table of one line program (One per compilation unit) */
+typedef struct cst_line_unit {
+	const char *comp_dir;  // Relative directories are relative to it
+	cst_line_file *files;
+	size_t count;
+	struct cst_line_unit *next;
+} cst_line_unit;
+
+typedef struct cst_line_row {
+	uintptr_t addr;
+	const cst_line_unit *unit;
+	unsigned int file;
+	unsigned int line;  // 0 ends a sequence
+} cst_line_row;
+
+typedef struct cst_module {
+	char *path;
+	void *map;
+	size_t map_size;
+	uintptr_t base;  // Address the module's mapping starts at, in the file
+	cst_sym *syms;
+	size_t sym_count;
+	cst_line_row *rows;
+	size_t row_count;
+	cst_line_unit *units;
+	struct cst_module *next;
+} cst_module;
+
+static cst_module *g_modules = NULL;
+static int g_modules_lock = 0;
+
+/*
+ - Helper: Bounded reads from mapped sections
+ */
+
+typedef struct cst_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool error;
+} cst_reader;
+
+static uint64_t read_u(cst_reader *r, size_t n)
+{
+	uint64_t v = 0;
+
+	if (r->error || (size_t) (r->end - r->p) < n) {
+		r->error = true;
+		return 0;
+	}
+	for (size_t i = 0; i < n; i++)
+		v |= (uint64_t) r->p[i] << (8 * i);
+	r->p += n;
+	return v;
+}
+
+static uint64_t read_uleb(cst_reader *r)
+{
+	uint64_t v = 0;
+	unsigned int shift = 0;
+
+	while (!r->error) {
+		if (r->p >= r->end) {
+			r->error = true;
+			break;
+		}
+		uint8_t byte = *r->p++;
+		if (shift < 64)
+			v |= (uint64_t) (byte & 0x7F) << shift;
+		shift += 7;
+		if ((byte & 0x80) == 0)
+			break;
+	}
+	return v;
+}
+
+static int64_t read_sleb(cst_reader *r)
+{
+	int64_t v = 0;
+	unsigned int shift = 0;
+	uint8_t byte = 0;
+
+	while (!r->error) {
+		if (r->p >= r->end) {
+			r->error = true;
+			return 0;
+		}
+		byte = *r->p++;
+		if (shift < 64)
+			v |= (int64_t) (byte & 0x7F) << shift;
+		shift += 7;
+		if ((byte & 0x80) == 0)
+			break;
+	}
+	if (shift < 64 && (byte & 0x40))
+		v |= -((int64_t) 1 << shift);
+	return v;
+}
+
+static const char *read_str(cst_reader *r)
+{
+	const char *s = (const char *) r->p;
+	const uint8_t *nul = memchr(r->p, '\0', r->end - r->p);
+
+	if (r->error || nul == NULL) {
+		r->error = true;
+		return NULL;
+	}
+	r->p = nul + 1;
+	return s;
+}
+
+static void skip(cst_reader *r, size_t n)
+{
+	if ((size_t) (r->end - r->p) < n)
+		r->error = true;
+	else
+		r->p += n;
+}
+
+/*
+ - Helper: ELF sections
+ */
+
+typedef struct cst_section {
+	const uint8_t *data;
+	size_t size;
+} cst_section;
+
+typedef struct cst_elf {
+	const uint8_t *map;
+	size_t size;
+	const ElfW(Ehdr) *ehdr;
+	const ElfW(Shdr) *shdrs;
+	const char *shstrtab;
+} cst_elf;
+
+static const ElfW(Shdr) *find_section(const cst_elf *elf, const char *name)
+{
+	for (size_t i = 0; i < elf->ehdr->e_shnum; i++) {
+		const ElfW(Shdr) *sh = &elf->shdrs[i];
+		if (strcmp(elf->shstrtab + sh->sh_name, name) == 0)
+			return sh;
+	}
+	return NULL;
+}
+
+static cst_section section_data(const cst_elf *elf, const ElfW(Shdr) *sh)
+{
+	cst_section sec = {0};
+
+	if (sh == NULL || sh->sh_type == SHT_NOBITS || (sh->sh_flags & SHF_COMPRESSED))
+		return sec;
+	if (sh->sh_offset > elf->size || sh->sh_size > elf->size - sh->sh_offset)
+		return sec;
+	sec.data = elf->map + sh->sh_offset;
+	sec.size = sh->sh_size;
+	return sec;
+}
+
+static bool open_elf(cst_elf *elf, const void *map, size_t size)
+{
+	elf->map = map;
+	elf->size = size;
+	elf->ehdr = map;
+	if (size < sizeof(ElfW(Ehdr)) || memcmp(elf->ehdr->e_ident, ELFMAG, SELFMAG) != 0)
+		return false;
+	if (elf->ehdr->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32))
+		return false;
+	if (elf->ehdr->e_shoff == 0 || elf->ehdr->e_shstrndx >= elf->ehdr->e_shnum
+		|| elf->ehdr->e_shoff + elf->ehdr->e_shnum * sizeof(ElfW(Shdr)) > size)
+		return false;
+	elf->shdrs = (const ElfW(Shdr) *) (elf->map + elf->ehdr->e_shoff);
+	cst_section strtab = section_data(elf, &elf->shdrs[elf->ehdr->e_shstrndx]);
+	if (strtab.data == NULL)
+		return false;
+	elf->shstrtab = (const char *) strtab.data;
+	return true;
+}
+
+/*
+ - Helper: Function symbols, sorted by address
+ */
+
+static int compare_syms(const void *a, const void *b)
+{
+	const cst_sym *sa = a;
+	const cst_sym *sb = b;
+
+	if (sa->addr != sb->addr)
+		return sa->addr < sb->addr ? -1 : 1;
+	return sa->size < sb->size ? 1 : (sa->size > sb->size ? -1 : 0);
+}
+
+static void load_syms(cst_module *mod, const cst_elf *elf)
+{
+	const ElfW(Shdr) *symtab = find_section(elf, ".symtab");
+
+	if (symtab == NULL || section_data(elf, symtab).data == NULL)
+		symtab = find_section(elf, ".dynsym");
+	if (symtab == NULL || symtab->sh_link >= elf->ehdr->e_shnum)
+		return;
+	cst_section syms = section_data(elf, symtab);
+	cst_section strs = section_data(elf, &elf->shdrs[symtab->sh_link]);
+	if (syms.data == NULL || strs.data == NULL)
+		return;
+
+	size_t count = syms.size / sizeof(ElfW(Sym));
+	mod->syms = malloc((count + 1) * sizeof(cst_sym));
+	if (mod->syms == NULL)
+		return;
+	for (size_t i = 0; i < count; i++) {
+		const ElfW(Sym) *sym = (const ElfW(Sym) *) syms.data + i;
+		int type = ELF64_ST_TYPE(sym->st_info);
+		if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym->st_shndx == SHN_UNDEF
+			|| sym->st_value == 0 || sym->st_name >= strs.size)
+			continue;
+		mod->syms[mod->sym_count++] = (cst_sym) {
+			.addr = sym->st_value,
+			.size = sym->st_size,
+			.name = (const char *) strs.data + sym->st_name
+		};
+	}
+	qsort(mod->syms, mod->sym_count, sizeof(cst_sym), compare_syms);
+}
+
+static const cst_sym *find_sym(const cst_module *mod, uintptr_t addr)
+{
+	size_t lo = 0;
+	size_t hi = mod->sym_count;
+
+	// Last symbol starting at or before addr
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (mod->syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+	const cst_sym *sym = &mod->syms[lo - 1];
+	if (sym->size != 0 && addr >= sym->addr + sym->size)
+		return NULL;
+	return sym;
+}
+
+/*
+ - Helper: DWARF line programs (Versions 2 to 5)
+ */
+
+#define CST_DW_FORM_block 0x09
+#define CST_DW_FORM_block1 0x0a
+#define CST_DW_FORM_data1 0x0b
+#define CST_DW_FORM_data2 0x05
+#define CST_DW_FORM_data4 0x06
+#define CST_DW_FORM_data8 0x07
+#define CST_DW_FORM_data16 0x1e
+#define CST_DW_FORM_string 0x08
+#define CST_DW_FORM_strp 0x0e
+#define CST_DW_FORM_line_strp 0x1f
+#define CST_DW_FORM_udata 0x0f
+
+#define CST_DW_LNCT_path 1
+#define CST_DW_LNCT_directory_index 2
+
+typedef struct cst_dwarf {
+	cst_section line;
+	cst_section line_str;
+	cst_section str;
+} cst_dwarf;
+
+typedef struct cst_rows {
+	cst_line_row *rows;
+	size_t count;
+	size_t cap;
+} cst_rows;
+
+static void add_row(cst_rows *rows, uintptr_t addr, const cst_line_unit *unit, unsigned int file, unsigned int line)
+{
+	if (rows->count == rows->cap) {
+		size_t cap = rows->cap ? rows->cap * 2 : 1024;
+		cst_line_row *grown = realloc(rows->rows, cap * sizeof(cst_line_row));
+		if (grown == NULL)
+			return;
+		rows->rows = grown;
+		rows->cap = cap;
+	}
+	rows->rows[rows->count++] = (cst_line_row) { .addr = addr, .unit = unit, .file = file, .line = line };
+}
+
+/* Reads one attribute of a DWARF 5 entry, only strings and numbers are kept */
+static bool read_form(cst_reader *r, const cst_dwarf *dw, uint64_t form, size_t offset_size,
+	const char **str, uint64_t *num)
+{
+	uint64_t off;
+
+	switch (form) {
+		case CST_DW_FORM_string: *str = read_str(r); break;
+		case CST_DW_FORM_line_strp:
+		case CST_DW_FORM_strp: {
+			const cst_section *sec = form == CST_DW_FORM_strp ? &dw->str : &dw->line_str;
+			off = read_u(r, offset_size);
+			if (sec->data == NULL || off >= sec->size || memchr(sec->data + off, '\0', sec->size - off) == NULL)
+				*str = NULL;
+			else
+				*str = (const char *) sec->data + off;
+			break;
+		}
+		case CST_DW_FORM_udata: *num = read_uleb(r); break;
+		case CST_DW_FORM_data1: *num = read_u(r, 1); break;
+		case CST_DW_FORM_data2: *num = read_u(r, 2); break;
+		case CST_DW_FORM_data4: *num = read_u(r, 4); break;
+		case CST_DW_FORM_data8: *num = read_u(r, 8); break;
+		case CST_DW_FORM_data16: skip(r, 16); break;
+		case CST_DW_FORM_block: skip(r, read_uleb(r)); break;
+		case CST_DW_FORM_block1: skip(r, read_u(r, 1)); break;
+		default: return false;  // Indexed strings would need .debug_str_offsets
+	}
+	return !r->error;
+}
+
+/* DWARF 5 directory and file tables */
+static bool read_entries(cst_reader *r, const cst_dwarf *dw, size_t offset_size,
+	cst_line_file **out, size_t *count, const cst_line_file *dirs, size_t dir_count)
+{
+	uint64_t formats[16][2];
+	size_t format_count = read_u(r, 1);
+
+	if (format_count > 16)
+		return false;
+	for (size_t i = 0; i < format_count; i++) {
+		formats[i][0] = read_uleb(r);
+		formats[i][1] = read_uleb(r);
+	}
+	*count = read_uleb(r);
+	if (r->error || *count > (size_t) (r->end - r->p))
+		return false;
+	*out = calloc(*count + 1, sizeof(cst_line_file));
+	if (*out == NULL)
+		return false;
+	for (size_t i = 0; i < *count; i++) {
+		for (size_t f = 0; f < format_count; f++) {
+			const char *str = NULL;
+			uint64_t num = 0;
+			if (!read_form(r, dw, formats[f][1], offset_size, &str, &num))
+				return false;
+			if (formats[f][0] == CST_DW_LNCT_path)
+				(*out)[i].name = str;
+			else if (formats[f][0] == CST_DW_LNCT_directory_index && dirs != NULL && num < dir_count)
+				(*out)[i].dir = dirs[num].name;
+		}
+	}
+	return true;
+}
+
+/* Versions 2 to 4: NUL terminated lists, with 1-based file indexes */
+static bool read_legacy_entries(cst_reader *r, cst_line_unit *unit)
+{
+	const char *dirs[256];
+	size_t dir_count = 1;
+	size_t cap = 16;
+	const char *s;
+
+	dirs[0] = NULL;  // The compilation directory, which isn't in the header
+	while ((s = read_str(r)) != NULL && *s != '\0')
+		if (dir_count < 256)
+			dirs[dir_count++] = s;
+	unit->files = calloc(cap, sizeof(cst_line_file));
+	if (unit->files == NULL)
+		return false;
+	unit->count = 1;  // Index 0 is unused before DWARF 5
+	while ((s = read_str(r)) != NULL && *s != '\0') {
+		uint64_t dir = read_uleb(r);
+		read_uleb(r);  // Modification time
+		read_uleb(r);  // Size
+		if (unit->count == cap) {
+			cst_line_file *grown = realloc(unit->files, cap * 2 * sizeof(cst_line_file));
+			if (grown == NULL)
+				return false;
+			memset(grown + cap, 0, cap * sizeof(cst_line_file));
+			unit->files = grown;
+			cap *= 2;
+		}
+		unit->files[unit->count].name = s;
+		unit->files[unit->count].dir = dir < dir_count ? dirs[dir] : NULL;
+		unit->count++;
+	}
+	return !r->error;
+}
+
+static void run_line_program(cst_reader *r, const cst_line_unit *unit, uint8_t min_inst, int8_t line_base, uint8_t line_range, uint8_t opcode_base,
+	const uint8_t *opcode_lengths, size_t addr_size, cst_rows *rows)
+{
+	uintptr_t addr = 0;
+	unsigned int file = 1;
+	long line = 1;
+	bool valid = false;  // Sequences of discarded code start at address 0
+
+	while (!r->error && r->p < r->end) {
+		uint8_t op = (uint8_t) read_u(r, 1);
+		if (op >= opcode_base) {
+			uint8_t adj = op - opcode_base;
+			addr += (adj / line_range) * min_inst;
+			line += line_base + adj % line_range;
+			if (valid)
+				add_row(rows, addr, unit, file, (unsigned int) line);
+			continue;
+		}
+		switch (op) {
+			case 0: {
+				uint64_t len = read_uleb(r);
+				const uint8_t *next = r->p + len;
+				if (len == 0 || len > (uint64_t) (r->end - r->p)) {
+					r->error = true;
+					break;
+				}
+				uint8_t sub = (uint8_t) read_u(r, 1);
+				if (sub == 1) {  // End of sequence
+					if (valid)
+						add_row(rows, addr, unit, file, 0);
+					addr = 0;
+					file = 1;
+					line = 1;
+					valid = false;
+				} else if (sub == 2) {  // Set address
+					addr = (uintptr_t) read_u(r, len - 1 < addr_size ? len - 1 : addr_size);
+					valid = addr != 0 && addr != (uintptr_t) -1;
+				}
+				r->p = next;
+				break;
+			}
+			case 1: if (valid) add_row(rows, addr, unit, file, (unsigned int) line); break;
+			case 2: addr += read_uleb(r) * min_inst; break;
+			case 3: line += read_sleb(r); break;
+			case 4: file = (unsigned int) read_uleb(r); break;
+			case 8: addr += ((255 - opcode_base) / line_range) * min_inst; break;
+			case 9: addr += read_u(r, 2); break;
+			default:
+				// Column, statement and block flags, ISA, and unknown opcodes
+				for (uint8_t i = 0; i < opcode_lengths[op - 1]; i++)
+					read_uleb(r);
+				break;
+		}
+	}
+}
+
+static void load_line_unit(cst_module *mod, cst_reader *unit_r, size_t offset_size, cst_dwarf *dw, cst_rows *rows)
+{
+	cst_reader *r = unit_r;
+	uint16_t version = (uint16_t) read_u(r, 2);
+	size_t addr_size = sizeof(void *);
+	cst_line_unit *unit;
+
+	if (version < 2 || version > 5)
+		return;
+	if (version >= 5) {
+		addr_size = read_u(r, 1);
+		read_u(r, 1);  // Segment selector size
+	}
+	uint64_t header_length = read_u(r, offset_size);
+	if (r->error || header_length > (uint64_t) (r->end - r->p))
+		return;
+	cst_reader program = { r->p + header_length, r->end, false };
+	uint8_t min_inst = (uint8_t) read_u(r, 1);
+	if (version >= 4)
+		read_u(r, 1);  // Maximum operations per instruction, VLIW only
+	read_u(r, 1);  // Default is_stmt, all rows are kept
+	int8_t line_base = (int8_t) read_u(r, 1);
+	uint8_t line_range = (uint8_t) read_u(r, 1);
+	uint8_t opcode_base = (uint8_t) read_u(r, 1);
+	const uint8_t *opcode_lengths = r->p;
+	skip(r, opcode_base > 0 ? opcode_base - 1 : 0);
+	if (r->error || line_range == 0 || opcode_base == 0)
+		return;
+
+	unit = calloc(1, sizeof(cst_line_unit));
+	if (unit == NULL)
+		return;
+	unit->next = mod->units;
+	mod->units = unit;
+	if (version >= 5) {
+		cst_line_file *dirs = NULL;
+		size_t dir_count = 0;
+		bool ok = read_entries(r, dw, offset_size, &dirs, &dir_count, NULL, 0)
+			&& read_entries(r, dw, offset_size, &unit->files, &unit->count, dirs, dir_count);
+		if (dir_count > 0)
+			unit->comp_dir = dirs[0].name;
+		free(dirs);
+		if (!ok)
+			return;
+	} else if (!read_legacy_entries(r, unit))
+		return;
+	run_line_program(&program, unit, min_inst, line_base, line_range,
+		opcode_base, opcode_lengths, addr_size, rows);
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+	const cst_line_row *ra = a;
+	const cst_line_row *rb = b;
+
+	if (ra->addr != rb->addr)
+		return ra->addr < rb->addr ? -1 : 1;
+	// A sequence ending where another starts mustn't hide it
+	return (ra->line != 0) - (rb->line != 0);
+}
+
+static void load_lines(cst_module *mod, const cst_elf *elf)
+{
+	cst_dwarf dw = {
+		.line = section_data(elf, find_section(elf, ".debug_line")),
+		.line_str = section_data(elf, find_section(elf, ".debug_line_str")),
+		.str = section_data(elf, find_section(elf, ".debug_str"))
+	};
+	cst_reader r = { dw.line.data, dw.line.data + dw.line.size, false };
+	cst_rows rows = {0};
+
+	if (dw.line.data == NULL)
+		return;
+	while (!r.error && r.p < r.end) {
+		size_t offset_size = 4;
+		uint64_t length = read_u(&r, 4);
+		if (length == 0xFFFFFFFF) {
+			offset_size = 8;
+			length = read_u(&r, 8);
+		}
+		if (r.error || length > (uint64_t) (r.end - r.p))
+			break;
+		cst_reader unit = { r.p, r.p + length, false };
+		load_line_unit(mod, &unit, offset_size, &dw, &rows);
+		r.p += length;
+	}
+	qsort(rows.rows, rows.count, sizeof(cst_line_row), compare_rows);
+	mod->rows = rows.rows;
+	mod->row_count = rows.count;
+}
+
+static const cst_line_row *find_row(const cst_module *mod, uintptr_t addr)
+{
+	size_t lo = 0;
+	size_t hi = mod->row_count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (mod->rows[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || mod->rows[lo - 1].line == 0)
+		return NULL;
+	return &mod->rows[lo - 1];
+}
+
+/*
+ - Helper: Loaded modules, parsed on first use
+ */
+
+static cst_module *load_module(const char *path)
+{
+	cst_module *mod = calloc(1, sizeof(cst_module));
+	struct stat st;
+	cst_elf elf;
+	int fd;
+
+	if (mod == NULL || (mod->path = strdup(path)) == NULL) {
+		free(mod);
+		return NULL;
+	}
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0) {
+		mod->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		mod->map_size = st.st_size;
+		if (mod->map == MAP_FAILED)
+			mod->map = NULL;
+	}
+	if (fd != -1)
+		close(fd);
+	// Unreadable modules are kept too, so they're only tried once
+	if (mod->map == NULL || !open_elf(&elf, mod->map, mod->map_size))
+		return mod;
+
+	const ElfW(Phdr) *phdrs = (const ElfW(Phdr) *) (elf.map + elf.ehdr->e_phoff);
+	bool base_found = false;
+	if (elf.ehdr->e_phoff + elf.ehdr->e_phnum * sizeof(ElfW(Phdr)) <= elf.size) {
+		for (size_t i = 0; i < elf.ehdr->e_phnum; i++) {
+			if (phdrs[i].p_type != PT_LOAD)
+				continue;
+			uintptr_t start = phdrs[i].p_vaddr & ~(uintptr_t) 0xFFF;
+			if (!base_found || start < mod->base)
+				mod->base = start;
+			base_found = true;
+		}
+	}
+	load_syms(mod, &elf);
+	load_lines(mod, &elf);
+	return mod;
+}
+
+static cst_module *get_module(const char *path)
+{
+	cst_module *mod;
+
+	for (mod = g_modules; mod != NULL; mod = mod->next)
+		if (strcmp(mod->path, path) == 0)
+			return mod;
+	mod = load_module(path);
+	if (mod != NULL) {
+		mod->next = g_modules;
+		g_modules = mod;
+	}
+	return mod;
+}
+
+/*
+ - Internal API: Resolve an address of the module at `path`, given as an
+ - offset from where the module is mapped (Its Dl_info base), into
+ - "function at file:line", like `addr2line -f -p` does.
+ */
+
+bool cst_sym_resolve(const char *path, uintptr_t offset, char *buf, size_t size)
+{
+	const cst_sym *sym = NULL;
+	const cst_line_row *row = NULL;
+	const char *func;
+	const char *file = NULL;
+	const char *dir = NULL;
+	const char *comp_dir = NULL;
+
+	if (path == NULL || buf == NULL || size == 0)
+		return false;
+	while (__atomic_exchange_n(&g_modules_lock, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+	cst_module *mod = get_module(path);
+	if (mod != NULL) {
+		uintptr_t addr = mod->base + offset;
+		sym = find_sym(mod, addr);
+		row = find_row(mod, addr);
+		if (row != NULL && row->file < row->unit->count) {
+			file = row->unit->files[row->file].name;
+			dir = row->unit->files[row->file].dir;
+			comp_dir = row->unit->comp_dir;
+		}
+	}
+	__atomic_store_n(&g_modules_lock, 0, __ATOMIC_RELEASE);
+
+	if (sym == NULL && file == NULL)
+		return false;
+	func = sym != NULL ? sym->name : "??";
+	if (file == NULL)
+		snprintf(buf, size, "%s at ??:?", func);
+	else if (file[0] == '/' || dir == NULL)
+		snprintf(buf, size, "%s at %s:%u", func, file, row->line);
+	else if (dir[0] == '/' || comp_dir == NULL || dir == comp_dir)
+		snprintf(buf, size, "%s at %s/%s:%u", func, dir, file, row->line);
+	else
+		snprintf(buf, size, "%s at %s/%s/%s:%u", func, comp_dir, dir, file, row->line);
+	return true;
+}
+
+/* Only the function name, for profiles */
+bool cst_sym_function(const char *path, uintptr_t offset, char *buf, size_t size)
+{
+	const cst_sym *sym = NULL;
+
+	if (path == NULL || buf == NULL || size == 0)
+		return false;
+	while (__atomic_exchange_n(&g_modules_lock, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+	cst_module *mod = get_module(path);
+	if (mod != NULL)
+		sym = find_sym(mod, mod->base + offset);
+	if (sym != NULL)
+		snprintf(buf, size, "%s", sym->name);
+	__atomic_store_n(&g_modules_lock, 0, __ATOMIC_RELEASE);
+	return sym != NULL;
+}
@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include "cst.h"
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+/*
+ - Virtual time (cst_virtual_time, -virtual-time)
+ -
+ - libcst defines the sleep and clock functions itself, like it does the
+ - allocator, and forwards them to glibc until a test turns virtual time
+ - on. From then on, the test's clocks only move when it sleeps: sleeping
+ - returns at once and moves every clock forward by the time slept, so
+ - retry and backoff logic runs in microseconds and reads exact times.
+ -
+ - Only the test's child is affected, the runner's timeouts stay in real
+ - time. CST's own timers in the child use cst_real_clock_gettime.
+ */
+
+typedef int (*cst_clock_gettime_fn)(clockid_t, struct timespec *);
+typedef int (*cst_clock_nanosleep_fn)(clockid_t, int, const struct timespec *, struct timespec *);
+
+static bool g_all = false;
+static bool g_enabled = false;
+static cst_clock_gettime_fn g_clock_gettime = NULL;
+static cst_clock_nanosleep_fn g_clock_nanosleep = NULL;
+
+/* Clocks that measure elapsed time, CPU time clocks aren't virtual */
+static const clockid_t g_clocks[] = {
+	CLOCK_REALTIME, CLOCK_REALTIME_COARSE, CLOCK_MONOTONIC,
+	CLOCK_MONOTONIC_RAW, CLOCK_MONOTONIC_COARSE, CLOCK_BOOTTIME
+};
+#define CST_VIRTUAL_CLOCKS (sizeof(g_clocks) / sizeof(g_clocks[0]))
+
+/* Real time of each clock when virtual time started, and nanoseconds slept since */
+static struct timespec g_bases[CST_VIRTUAL_CLOCKS];
+static uint64_t g_slept = 0;
+
+/*
+ - Real clock
+ */
+
+int cst_real_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	if (g_clock_gettime != NULL)
+		return g_clock_gettime(clock, ts);
+	return (int) syscall(SYS_clock_gettime, clock, ts);
+}
+
+static int real_clock_nanosleep(clockid_t clock, int flags, const struct timespec *req, struct timespec *rem)
+{
+	if (g_clock_nanosleep != NULL)
+		return g_clock_nanosleep(clock, flags, req, rem);
+	return syscall(SYS_clock_nanosleep, clock, flags, req, rem) == -1 ? errno : 0;
+}
+
+/*
+ - Helper: Virtual clock
+ */
+
+static uint64_t to_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000ULL + (uint64_t) ts->tv_nsec;
+}
+
+static struct timespec from_ns(uint64_t ns)
+{
+	return (struct timespec) { .tv_sec = (time_t) (ns / 1000000000ULL), .tv_nsec = (long) (ns % 1000000000ULL) };
+}
+
+/* Each clock moves from its own base, they don't all start from the same time */
+static const struct timespec *virtual_base(clockid_t clock)
+{
+	for (size_t i = 0; i < CST_VIRTUAL_CLOCKS; i++)
+		if (g_clocks[i] == clock)
+			return &g_bases[i];
+	return NULL;
+}
+
+static uint64_t virtual_now(const struct timespec *base)
+{
+	return to_ns(base) + __atomic_load_n(&g_slept, __ATOMIC_ACQUIRE);
+}
+
+/* Moves the clocks forward by `ns`, or up to `ns` of `base` when absolute */
+static void virtual_sleep(const struct timespec *base, bool absolute, uint64_t ns)
+{
+	if (absolute) {
+		uint64_t now = virtual_now(base);
+		ns = ns > now ? ns - now : 0;
+	}
+	__atomic_add_fetch(&g_slept, ns, __ATOMIC_ACQ_REL);
+}
+
+/*
+ - Interposed functions
+ */
+
+int clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	const struct timespec *base;
+
+	if (__builtin_expect(!g_enabled, 1) || (base = virtual_base(clock)) == NULL)
+		return cst_real_clock_gettime(clock, ts);
+	*ts = from_ns(virtual_now(base));
+	return 0;
+}
+
+int gettimeofday(struct timeval *restrict tv, void *restrict tz)
+{
+	struct timespec ts;
+
+	(void) tz;
+	if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+		return -1;
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+	return 0;
+}
+
+time_t time(time_t *tloc)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+		return (time_t) -1;
+	if (tloc != NULL)
+		*tloc = ts.tv_sec;
+	return ts.tv_sec;
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const struct timespec *req, struct timespec *rem)
+{
+	const struct timespec *base;
+
+	if (__builtin_expect(!g_enabled, 1) || (base = virtual_base(clock)) == NULL)
+		return real_clock_nanosleep(clock, flags, req, rem);
+	if (req->tv_nsec < 0 || req->tv_nsec >= 1000000000L || req->tv_sec < 0)
+		return EINVAL;
+	virtual_sleep(base, (flags & TIMER_ABSTIME) != 0, to_ns(req));
+	if (rem != NULL && (flags & TIMER_ABSTIME) == 0)
+		*rem = (struct timespec) { 0 };
+	return 0;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	int err = clock_nanosleep(CLOCK_MONOTONIC, 0, req, rem);
+
+	if (err == 0)
+		return 0;
+	errno = err;
+	return -1;
+}
+
+int usleep(useconds_t usec)
+{
+	struct timespec req = from_ns((uint64_t) usec * 1000);
+
+	return nanosleep(&req, NULL);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+	struct timespec req = { .tv_sec = seconds, .tv_nsec = 0 };
+	struct timespec rem = { 0 };
+
+	if (nanosleep(&req, &rem) == -1)
+		return (unsigned int) rem.tv_sec + (rem.tv_nsec > 0);
+	return 0;
+}
+
+/*
+ - Public API
+ */
+
+void cst_virtual_time(void)
+{
+	if (g_enabled)
+		return;
+	for (size_t i = 0; i < CST_VIRTUAL_CLOCKS; i++)
+		cst_real_clock_gettime(g_clocks[i], &g_bases[i]);
+	g_slept = 0;
+	__atomic_store_n(&g_enabled, true, __ATOMIC_RELEASE);
+}
+
+/*
+ - Internal API: Called by cst.c
+ */
+
+/* Resolves glibc's functions once, in the runner */
+void cst_time_init(bool all)
+{
+	g_all = all;
+	g_clock_gettime = (cst_clock_gettime_fn) dlsym(RTLD_NEXT, "clock_gettime");
+	g_clock_nanosleep = (cst_clock_nanosleep_fn) dlsym(RTLD_NEXT, "clock_nanosleep");
+}
+
+/* Called in the test's child, right before the test runs */
+void cst_time_test_start(void)
+{
+	if (g_all)
+		cst_virtual_time();
+}
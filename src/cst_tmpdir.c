@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#define CST_NO_MEMCHECK  // The scratch directory belongs to CST, not to the test
+#include "cst.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+/*
+ - Per-test scratch directories (CST_TMPDIR)
+ -
+ - Before forking a test's child, the runner makes a directory of its own
+ - with mkdtemp, so its name can't be guessed, and the test's directory in
+ - it, which the child exports right away. The first time the test asks
+ - for it, if it's still empty and CST is allowed to, the child moves to a
+ - private mount namespace and mounts a tmpfs on it: nothing it writes is
+ - visible outside of it, and the whole tree goes away with the namespace
+ - when the child exits. The namespace costs more than the rest of a test,
+ - so tests that don't ask don't pay for it. Otherwise it's a plain
+ - directory, on /dev/shm when there is one. Either way the runner removes
+ - what's left once the child is reaped, even if it crashed.
+ -
+ - Forks injected by -allocfail get a directory of their own next to the
+ - test's, in the runner's directory, so they can't see each other's files.
+ */
+
+/* Leaves room for "/cst-XXXXXX/<fork>" */
+static char g_base[CST_PATH_MAX - 64] = "/tmp";
+static char g_dir[CST_PATH_MAX - 32];  // The runner's, holding the test's
+static char g_path[CST_PATH_MAX];
+static bool g_asked = false;
+
+/*
+ - From cst_memcheck.c
+ */
+
+extern __thread int	cst_memcheck_depth;
+
+/* A tmpfs mounted on `dir` in a mount namespace of the child's own */
+static bool mount_private_tmpfs(const char *dir)
+{
+	// Fails without CAP_SYS_ADMIN, or once the test has started threads
+	if (unshare(CLONE_NEWNS) == -1)
+		return false;
+	// Or the tmpfs would show up in the runner's namespace too
+	if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+		return false;
+	return mount("cst", dir, "tmpfs", MS_NOSUID | MS_NODEV, "mode=0700") == 0;
+}
+
+/* Files written there through $TMPDIR would be hidden under the tmpfs */
+static bool is_empty(const char *dir)
+{
+	DIR *d;
+	struct dirent *entry;
+	size_t entries = 0;
+
+	cst_memcheck_depth++;
+	if ((d = opendir(dir)) != NULL) {
+		while ((entry = readdir(d)) != NULL)
+			entries += strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+		closedir(d);
+	}
+	cst_memcheck_depth--;
+	return d != NULL && entries == 0;
+}
+
+/* So that commands run by the test, and libraries that honor TMPDIR, use it too */
+static void export_path(void)
+{
+	cst_memcheck_depth++;
+	if (g_path[0] != '\0') {
+		setenv("CST_TMPDIR", g_path, 1);
+		setenv("TMPDIR", g_path, 1);
+	} else {
+		unsetenv("CST_TMPDIR");
+		unsetenv("TMPDIR");
+	}
+	cst_memcheck_depth--;
+}
+
+/*
+ - Public API
+ */
+
+char *cst_tmpdir(void)
+{
+	if (g_path[0] == '\0')
+		return NULL;
+	if (!g_asked) {
+		g_asked = true;
+		if (is_empty(g_path))
+			mount_private_tmpfs(g_path);
+	}
+	return g_path;
+}
+
+/*
+ - Internal API: Called by cst.c
+ */
+
+/* Prefers /dev/shm, which is already in memory, then $TMPDIR */
+void cst_tmpdir_init(void)
+{
+	const char *tmp = getenv("TMPDIR");
+
+	if (access("/dev/shm", W_OK | X_OK) == 0)
+		snprintf(g_base, sizeof(g_base), "/dev/shm");
+	else if (tmp != NULL && tmp[0] != '\0' && access(tmp, W_OK | X_OK) == 0)
+		snprintf(g_base, sizeof(g_base), "%s", tmp);
+}
+
+/* Called by the runner right before forking a test's child */
+void cst_tmpdir_next(void)
+{
+	g_asked = false;
+	g_path[0] = '\0';
+	snprintf(g_dir, sizeof(g_dir), "%s/cst-XXXXXX", g_base);
+	if (mkdtemp(g_dir) == NULL) {
+		g_dir[0] = '\0';
+		return;
+	}
+	snprintf(g_path, sizeof(g_path), "%s/test", g_dir);
+	if (mkdir(g_path, 0700) == -1)
+		g_path[0] = '\0';
+}
+
+/* Called in the test's child, before the test runs */
+void cst_tmpdir_test_start(void)
+{
+	export_path();
+}
+
+/*
+ - Internal API: Called by cst_allocfail.c
+ */
+
+/* Called in a fork injected by -allocfail, which mustn't share the test's directory */
+void cst_tmpdir_injected(size_t index)
+{
+	if (g_dir[0] == '\0')
+		return;
+	g_asked = false;
+	snprintf(g_path, sizeof(g_path), "%s/%zu", g_dir, index);
+	if (mkdir(g_path, 0700) == -1)
+		g_path[0] = '\0';
+	export_path();
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void) st;
+	(void) flag;
+	(void) ftw;
+	remove(path);
+	return 0;
+}
+
+/* Called by the runner once the child is reaped */
+void cst_tmpdir_done(void)
+{
+	if (g_dir[0] == '\0')
+		return;
+	// Emptied mount points, unless something was written to a plain directory
+	if ((g_path[0] != '\0' && rmdir(g_path) == -1) || rmdir(g_dir) == -1)
+		nftw(g_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	g_dir[0] = '\0';
+	g_path[0] = '\0';
+}